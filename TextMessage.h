@@ -16,6 +16,146 @@
 #define TRUE 1
 #define FALSE 0
 
+// How USART3 receive is handled.  RX_MODE_IRQ is the original interrupt per
+// character, RX_MODE_DMA has DMA1 fill a circular buffer and only interrupts
+// on idle line (or half/full buffer), so TextRX parses whole bursts at once.
+#define RX_MODE_IRQ 0
+#define RX_MODE_DMA 1
+#ifndef RX_MODE
+#define RX_MODE RX_MODE_DMA
+#endif
+
+// size of the circular DMA receive buffer, has to hold everything that can
+// arrive while TextRX is busy committing a batch, ~20ms at 921600 baud.
+#define RX_DMA_SIZE 2048
+
+// depth of the byte ring between the USART3 ISR and TextRX in RX_MODE_IRQ.
+// Must be a power of two.  Overflows are counted in rxRing.overflows.
+#define RX_RING_SIZE 1024
+
+// receive flow control, XON/XOFF since USART3's RTS pin (PD12) is an SRAM
+// address line on this board.
+// XOFF once this many bytes are waiting to be parsed, XON once it's back down.
+#if RX_MODE == RX_MODE_DMA
+#define RX_HIGH_WATER (RX_DMA_SIZE * 3 / 4)
+#define RX_LOW_WATER (RX_DMA_SIZE / 4)
+#else
+#define RX_HIGH_WATER (RX_RING_SIZE * 3 / 4)
+#define RX_LOW_WATER (RX_RING_SIZE / 4)
+#endif
+
+// the bottom of the external SRAM holds the LCD's 16x24 glyphs ready
+// expanded to pixels, for GLYPH_SETS text/background colour pairs at once
+// (white on black for nearly everything, black on red for the delete menu)
+#define GLYPH_SETS 2
+#define GLYPH_CACHE (GLYPH_SETS * (uint32_t)GLCD_GLYPH_SET)
+
+// then the frame, the whole screen as RGB565 pixels a row at a time.  Tasks
+// draw into it and FlushTask copies the text cells that changed to the LCD.
+#define FRAME_BASE (mySRAM_BASE + GLYPH_CACHE)
+#define FRAME_SIZE (LCD_WIDTH * LCD_HEIGHT * 2UL)
+
+// the message store takes the external SRAM from STORE_BASE to the end.
+// STORE_SIZE is that at the configured SRAM size, the real figure
+// (storeSize) is worked out at boot from what's fitted.  The first
+// 1/STORE_HDR_SHARE of it is a table of fixed size message headers (list
+// links, length, time, flags), then the full text search index (about 4
+// bytes per header, see Trigram.h), the rest a circular log of text blobs.
+// Headers and text are filled in arrival order and the oldest message is
+// evicted from both once either is full.  At 4 MB that's about 34k headers
+// and 2.7 MB of text.  It all survives a warm reset and is picked back up.
+#define STORE_BASE (FRAME_BASE + FRAME_SIZE)
+#define STORE_SIZE (mySRAM_SIZE - (STORE_BASE - mySRAM_BASE))
+#define STORE_HDR_SHARE 4
+
+// every TIME_SAMPLE'th header slot has its arrival time kept in internal
+// RAM, so seeking by time is a binary search there and a short scan here.
+// The table is a whole number of them, so a multiple of TRI_CHUNK.
+#define TIME_SAMPLE 64
+
+// message text is stored 6-bit packed (see TextPack.h) when TRUE, about a
+// quarter smaller for ordinary text.  Punctuation takes two codes, so the
+// worst case is TEXT_BYTES_MAX for a 160 character message.
+#ifndef TEXT_PACKED
+#define TEXT_PACKED TRUE
+#endif
+#if TEXT_PACKED
+#define TEXT_BYTES_MAX 240
+#else
+#define TEXT_BYTES_MAX 160
+#endif
+
+// message header flags
+#define MSG_PEND 0		// still being received, not in the list yet
+#define MSG_LIVE 1		// in lstStr
+#define MSG_DEAD 2		// deleted, its slot comes back when the store gets round to it
+										// (or the compactor's moved it out, text NULL then)
+
+// in every committed header, so a scan after a reset can tell them from junk
+#define MSG_MAGIC 0xA7
+
+// how the store came back at power up
+#define RECOVER_NONE 0	// it didn't, started empty
+#define RECOVER_FAST 1	// from the copy of where it was in the backup SRAM
+#define RECOVER_SCAN 2	// by checking every header
+
+// how often (ticks) TextRX retries storage it couldn't get
+#define FLOW_POLL 50
+
+// receive modes, switched at runtime with CMD_MODE.  Frames are understood
+// in both; plain typing is ignored in RXMODE_FRAMED.
+#define RXMODE_TEXT 0
+#define RXMODE_FRAMED 1
+
+// a frame that goes quiet for this many ticks is dropped
+#define FRAME_TIMEOUT 500
+
+// command frame commands (first payload byte of a FRAME_CMD)
+#define CMD_MODE 0x01		// [mode][baud, 4 bytes LSB first, 0 keeps the current rate]
+#define CMD_EXPORT 0x02		// stream every stored message back as CSV
+#define CMD_BENCH 0x03		// time list walks over 1k, 10k and 30k messages, results back as CSV
+#define CMD_GOTO 0x04		// [position, 4 bytes LSB first, 1 is the oldest] show that message
+#define CMD_SEEK 0x05		// [hours][minutes][seconds] show the first message from then on
+#define CMD_DELETE 0x06		// [0] delete everything, [1][hours][minutes][seconds] everything older than then
+#define CMD_SEARCH 0x07		// [text, up to 15 characters] find the messages with it in, hit count back as CSV
+#define CMD_ARCHIVE 0x08	// stream the flash archive back as CSV
+
+// delete menu choices, in the order the joystick steps through them
+#define DEL_NO 0				// leave it
+#define DEL_ONE 1				// the message on screen
+#define DEL_OLDER 2			// everything older than the message on screen
+#define DEL_ALL 3				// everything
+#define DEL_CHOICES 4
+
+// most search hits kept for the display to step through
+#define SEARCH_HITS 128
+
+// ticks without a new message before ArchiverTask puts a part full page in flash
+#define ARC_IDLE 2000
+
+// header slots CompactTask looks through per mut_msgList hold when it's
+// hunting for the next message to move, and how sparse the store has to be
+// before it bothers: a pass can move everything below the newest hole, so
+// it waits for more than 1/CMP_SPARSE of the slots stored to be holes
+#define CMP_SCAN 64
+#define CMP_SPARSE 8
+
+// messages ExportTask copies out per mut_msgList hold, and the longest CSV
+// line (time, comma, quotes, every character doubled, CR LF)
+#define EXPORT_CHUNK 8
+#define EXPORT_LINE (9 + 2 + 160 * 2 + 2)
+
+// the 320x240 LCD as a grid of font 1 (16x24) characters
+#define LCD_WIDTH 320
+#define LCD_HEIGHT 240
+#define LCD_ROWS 10
+#define LCD_COLS 20
+#define CELL_W (LCD_WIDTH / LCD_COLS)
+#define CELL_H (LCD_HEIGHT / LCD_ROWS)
+
+// characters drawn for each glyphs a second figure in the benchmark
+#define BENCH_GLYPHS 192
+
 
 // timestamp structure, to be used for the program itself and in each message
 typedef struct _Timestamp {
@@ -24,5 +164,8 @@ typedef struct _Timestamp {
 	uint8_t hours;
 } Timestamp;
 
+// seconds into the day
+#define TIME_SECS(t) ((t)->hours * 3600UL + (t)->minutes * 60 + (t)->seconds)
+
 
 #endif /* __TXTMSG_H */
@@ -8,8 +8,16 @@
 #include "boardlibs\I2C.h"
 #include "boardlibs\sram.h"
 #include "boardlibs\KBD.h"
+#include "boardlibs\CRC.h"
 
 #include "userlibs\LinkedList.h"
+#include "userlibs\RingBuffer.h"
+#include "userlibs\Frame.h"
+#include "userlibs\MsgLog.h"
+#include "userlibs\PosIndex.h"
+#include "userlibs\TextPack.h"
+#include "userlibs\Trigram.h"
+#include "userlibs\Archive.h"
 #include "userlibs\dbg.h"
 
 #include "TextMessage.h"
@@ -24,25 +32,121 @@
 *			messaging system via RS-232 with Keil ARM Development Board.
 *	---------------------------------------------------------------------------------
 *	UI:	System clock in upper left corner of screen, total stored message count in 
-*			upper right.  Messages are displayed in the center of the screen, 4 lines of 
+*			upper right with the position of the one on screen under it.  Messages are displayed in the center of the screen, 4 lines of 
 *			16 characters at a time.  Messages can be navigated by using the 4 direction
 *			joystick to the left of the screen.  Deletion of messages can be achieved by
 *			pushing center button of joystick, then selecting "YES" and pressing the
-*			center button again to confirm.
+*			center button again to confirm.  "Old" deletes everything older than the
+*			message on screen, "All" deletes everything.
 *----------------------------------------------------------------------------------
 *	Message TX/RX:
 *			Uses PuTTY to send messages, configure serial port to COM1 and 115200 baud.
 *			Force echo and local line editing if you wish, the code supports backspacing
 *			before a message is sent.  RETURN key will send a message.  Messages will
 *			automatically send if the character limit of 160 is reached during typing.
+*			For bulk loading, length-prefixed CRC checked frames (see Frame.h) can be
+*			sent at any time and carry many messages each.  A command frame switches
+*			to frames-only mode and/or a faster baud rate (921600 and up) and back.
 * =================================================================================
 *//////////////////////////////////////////////////////////////////////////////////
 
-// use this as the base pointer for an OS-managed memory pool later.
-ListNode *Storage = (ListNode *)mySRAM_BASE;
+// Message storage in external SRAM.  Headers (the list nodes) sit in a
+// dense table of their own so walking the list never drags text across the
+// bus; the text goes in a circular log of blobs.  Both fill in arrival
+// order, and when either is full the oldest message goes to make room, so
+// it never runs out.  Only TextRX appends and evicts; flags of messages in
+// lstStr are protected by mut_msgList.
+struct HdrTable{
+	ListNode *slot;		// the table, STORE_BASE
+	uint32_t slots;		// how many headers it holds
+	uint32_t head;		// oldest header in use
+	uint32_t used;
+	uint32_t drop;		// slots at the head already cut out of lstStr, handed back
+										// next time TextRX needs room.  Protected by mut_msgList.
+};
+struct HdrTable hdrs;
+// oldest slot that's still stored
+#define hdrFirst() ((hdrs.head + hdrs.drop) % hdrs.slots)
+MsgLog Storage;
+
+// Position index over the header slots, a slot is set while its message is
+// in lstStr.  Since the table fills in list order, counting set slots from
+// hdrs.head gives a message's position and vice versa, in O(log n) either
+// way.  Protected by mut_msgList.
+#define HDR_MAX (STORE_SIZE / STORE_HDR_SHARE / sizeof(ListNode))
+uint32_t posBits[POS_WORDS(HDR_MAX)];
+uint32_t posTree[POS_CHUNKS(HDR_MAX) + 1];
+PosIndex msgIdx;
+
+// Time index.  Arrival times are kept as seconds since power up by counting
+// days (timeDay, bumped whenever the clock goes backwards, so midnight or
+// setting it).  timeKey[] has the time of every TIME_SAMPLE'th header slot;
+// in table order from hdrs.head they only go up.  Written by TextRX in
+// commitBatch(), protected by mut_msgList.
+uint32_t timeKey[HDR_MAX / TIME_SAMPLE + 1];
+uint32_t timeDay = 0;
+uint32_t timeLast = 0;	// time of the newest message
+uint32_t timeEnd = 0;		// and its slot
+
+// Full text search index, in SRAM right after the header table.  Postings
+// are per TRI_CHUNK header slots; a chunk's are wiped when its last message
+// is deleted or the table comes back round to it, which storeMakeRoom()
+// makes sure only happens with the whole chunk free.  Protected by
+// mut_msgList.
+TrigramIndex triIdx;
+// header slots the next message needs free: a whole chunk if it starts one
+#define hdrNeed() ((hdrs.head + hdrs.used) % TRI_CHUNK == 0 ? TRI_CHUNK : 1)
+
+// what the last CMD_SEARCH found, oldest first.  The key (timeKeyOf()) is
+// there to tell if a slot has been reused since.  Written by ExportTask
+// (CompactTask moves the slots along with the messages), protected by
+// mut_msgList.
+struct Found{
+	uint32_t slot[SEARCH_HITS];
+	uint32_t key[SEARCH_HITS];
+	uint32_t count;
+	uint32_t searches;	// bumped as each search starts refilling it
+};
+struct Found found;
+
+// how many bytes of SRAM the store actually got, STORE_SIZE unless the SRAM
+// turned out smaller than configured.  Set once in InitTask.
+uint32_t storeSize = STORE_SIZE;
+
+// sequence number for the next header handed out.  Only TextRX writes it.
+uint32_t storeSeq = 0;
 
-// the box for the receive queue
-_declare_box(poolRXQ, sizeof(ListNode), 4);
+// Where the store had got to, kept in the battery backed SRAM so a warm
+// reset can carry straight on from it.  dirty is set while lstStr or the
+// store are being changed and cleared once this is back in step; a reset
+// with it set falls back to checking every header.  Written under
+// mut_msgList.
+struct StoreSave{
+	uint32_t magic;			// STORE_SAVED once it's been written
+	uint32_t dirty;
+	uint32_t arc;				// arcSeq as of the last archive flush; the archiver's own, not checked
+	uint32_t check;			// saveCheck() of everything below
+	uint32_t size;			// storeSize and hdrs.slots, it's no good with another layout
+	uint32_t slots;
+	uint32_t head;			// hdrs
+	uint32_t used;
+	uint32_t drop;
+	List list;					// lstStr
+	uint32_t day;				// timeDay, timeLast and timeEnd
+	uint32_t last;
+	uint32_t end;
+	uint32_t seq;				// storeSeq, for when there's nothing stored to take it from
+};
+#define storeSave ((struct StoreSave *)BKPSRAM_BASE)
+#define STORE_SAVED 0x53415645
+
+// how the store came back at power up.  Written once in InitTask.
+struct RecoverStats{
+	uint8_t how;				// RECOVER_NONE, _FAST or _SCAN
+	uint32_t msgs;			// messages it got back
+	uint32_t cycles;		// how long it took
+};
+struct RecoverStats recoverStats;
 
 // event flag masks.  These could be defines, but eh.
 uint16_t timer10Hz = 0x0002;
@@ -58,6 +162,22 @@ uint16_t dispUser = 0x001f;
 uint16_t joyDir = JOY_LEFT | JOY_RIGHT | JOY_UP | JOY_DOWN;	//0x001B, all but the center button
 uint16_t joyPush = JOY_CENTER;
 uint16_t newMsg = 0x4000;
+uint16_t dispJump = 0x2000;
+uint16_t dispSeek = 0x1000;
+uint16_t dispFind = 0x0400;
+
+uint16_t exportCmd = 0x0001;
+uint16_t exportSent = 0x0002;
+uint16_t benchCmd = 0x0004;
+uint16_t searchCmd = 0x0008;
+
+uint16_t arcKick = 0x0001;
+uint16_t arcDump = 0x0002;
+
+uint16_t cmpKick = 0x0001;
+
+uint16_t flushKick = 0x0001;
+// and a task writing the LCD sleeps on GLCD_DMA_FLAG (0x0200) while the DMA does it
 
 /*
 * structures, variables, and mutexes
@@ -76,15 +196,149 @@ struct Cursor{
 };
 // cursor for which message, and where in the message
 struct Cursor cursor;
-List lstRXQ = {0, NULL, NULL};
+
+// what's in the frame, cell by cell, so a character that's already there
+// in the same colours doesn't get drawn again.  Everything goes on the
+// screen through the lcd*() functions to keep it true.  They only draw into
+// the frame in the SRAM; FlushTask copies the cells marked dirty to the LCD
+// after, so mut_LCD, which protects all this and the frame, is never held
+// while the LCD itself is written.  FlushTask and the benchmark share the
+// LCD controller under mut_panel, taken after mut_LCD when both are.
+struct Shadow{
+	uint8_t c[LCD_ROWS][LCD_COLS];
+	uint16_t text[LCD_ROWS][LCD_COLS];
+	uint16_t back[LCD_ROWS][LCD_COLS];
+	uint16_t textColor, backColor;	// what the next cell goes on in
+	uint32_t dirty[LCD_ROWS];				// a bit per column, drawn since FlushTask last looked
+	uint32_t drawn;									// cells actually drawn since power up
+};
+struct Shadow shadow;
+OS_MUT mut_panel;
+#define lcdFrame ((uint16_t *)FRAME_BASE)
+#define DIRTY_ROW ((1UL << LCD_COLS) - 1)
 List lstStr = {0, NULL, NULL};
 ListNode dfltMsg;
+#if TEXT_PACKED
+uint8_t dfltText[TEXT_BYTES_MAX];	// packed like everything else
+#endif
 
 void printToScreen(uint8_t time[], uint8_t pos,ListNode* dispNode);
+void printCount(uint8_t row, uint32_t n);
+void printFind(uint32_t n, uint8_t col);
+void printDelMenu(uint8_t select);
+void lcdColor(uint16_t text, uint16_t back);
+void lcdChar(uint8_t row, uint8_t col, uint8_t c);
+void lcdString(uint8_t row, uint8_t col, uint8_t *s);
+uint8_t lcdCell(uint8_t row, uint8_t col, uint8_t c);
+uint8_t lcdHas(uint8_t row, uint8_t col, uint8_t c);
+void flushRun(void);
+void lcdClear(uint16_t color);
 void timeToString(uint8_t time[], Timestamp* timestamp);
 
-// delcare mailbox for serial buffer
-os_mbx_declare(mbx_MsgBuffer, 4);
+#if RX_MODE == RX_MODE_DMA
+// circular buffer that DMA1 fills straight from USART3
+uint8_t rxDMABuf[RX_DMA_SIZE];
+#else
+// raw bytes from the USART3 ISR to TextRX.  Lock-free, the ISR only ever
+// moves the head and TextRX only ever moves the tail.
+uint8_t rxRingBuf[RX_RING_SIZE];
+RingBuffer rxRing;
+#endif
+
+// everything TextRX needs to turn received bytes into messages.  Only
+// TextRX touches this.
+struct RxState{
+	NodeData typing;		// message being typed, text in rxText
+	uint8_t pend;				// typing is finished but not in the store yet
+	uint8_t count;			// our place in typing's text
+	uint8_t mode;				// RXMODE_TEXT or RXMODE_FRAMED
+	List batch;					// finished, not yet committed messages
+	FrameRx frame;			// binary frame decoder
+	List frameMsgs;			// messages out of the frame in progress, held until its CRC checks
+	uint8_t ftext[160];	// text of the frame message being received
+	uint8_t fcnt;				// how much of it there is so far
+	uint8_t msgLeft;		// its text bytes still to come, 0 means a length byte is next
+	uint8_t frameErr;		// frame payload didn't make sense, throw it out even if the CRC is good
+	uint8_t cmd[16];		// command frame payload
+	uint8_t cmdLen;
+	uint32_t baud;			// baud rate to switch to once the ACK is out, 0 for none
+};
+struct RxState rx;
+
+// position (from 1) CMD_GOTO asked the display to jump to
+volatile uint32_t jumpTo = 0;
+
+// time CMD_SEEK asked the display to go to
+Timestamp seekTo;
+
+// text CMD_SEARCH asked ExportTask to look for
+uint8_t searchText[15];
+uint8_t searchLen;
+
+// how many messages the store has thrown out to make room.  Only TextRX writes it.
+uint32_t storeEvicted = 0;
+
+// typed messages are built here, the length isn't known until the return key
+// (and the stored size not until it's packed)
+uint8_t rxText[160];
+
+#if RX_MODE == RX_MODE_DMA
+// how far into rxDMABuf TextRX has parsed, so the ISRs can see the backlog
+volatile uint32_t rxDMARead = 0;
+// free running byte counts: written by the DMA as of its last half/full
+// buffer interrupt (only the ISR writes it), parsed by TextRX, and written
+// over by the DMA before TextRX got to them (TextRX, see rxDMALap())
+volatile uint32_t rxDMAWritten = 0;
+uint32_t rxDMAParsed = 0;
+uint32_t rxDMALost = 0;
+#endif
+
+uint8_t rxParseChar(NodeData *buf, uint8_t *idx, uint8_t data);
+uint8_t rxByte(uint8_t data);
+uint8_t rxReserve(void);
+ListNode *storeAlloc(uint8_t size);
+ListNode *storeMsg(uint8_t *text, uint8_t cnt);
+void msgText(NodeData *data, uint8_t from, uint8_t n, uint8_t *dst);
+uint8_t storeMakeRoom(uint8_t size);
+uint8_t *storeOldest(void);
+void msgUnlink(ListNode *node);
+void triTidy(uint32_t chunk);
+void triDrop(uint32_t from, uint32_t to);
+uint32_t msgPos(ListNode *node);
+ListNode *msgAt(uint32_t pos);
+void msgDropBefore(ListNode *keep);
+void timeMark(ListNode *node, uint32_t key);
+uint32_t timeKeyOf(ListNode *node);
+ListNode *timeSeek(Timestamp *t);
+uint16_t msgSig(uint8_t *text, uint8_t cnt);
+void rxFlow(uint32_t backlog);
+void rxDMALap(uint32_t wrIdx);
+void rxPayload(uint8_t data);
+void rxFrameDone(uint8_t result);
+void rxCommand(uint8_t *cmd, uint8_t len);
+void commitBatch(List *batch);
+uint16_t msgCheck(NodeData *data, uint8_t *text);
+uint8_t msgValid(ListNode *node, uint8_t *text);
+void storeDirty(void);
+void storeClean(void);
+uint32_t saveCheck(void);
+uint8_t storeRecover(void);
+uint8_t storeResume(void);
+uint8_t storeScan(void);
+void storeIndex(void);
+void storeWipe(void);
+void recoverReport(void);
+
+// ingest throughput, counted by TextRX and sampled once a second by
+// ClockTask.  Protected by mut_msgList.
+struct RxStats{
+	uint32_t msgs;			// messages committed since power up
+	uint32_t batches;		// lock round trips it took to commit them
+	uint32_t lastMsgs;	// msgs at the previous 1Hz sample
+	uint32_t rate;			// messages/second over the last second
+	uint32_t peakRate;	// best rate seen
+};
+struct RxStats rxStats;
 
 __task void InitTask(void);
 __task void TimerTask(void);
@@ -97,6 +351,97 @@ __task void TextRX(void);
 OS_TID idTextRX;
 __task void DisplayTask(void);
 OS_TID idDispTask;
+__task void ExportTask(void);
+OS_TID idExportTask;
+__task void ArchiverTask(void);
+OS_TID idArchiverTask;
+__task void CompactTask(void);
+OS_TID idCompactTask;
+__task void FlushTask(void);
+OS_TID idFlushTask;
+
+// Messages copied into internal flash as they're committed, so they outlive
+// the power going.  Only ArchiverTask touches it after InitTask opens it.
+Archive archive;
+// the next header slot to archive and the sequence number it should have.
+// ArchiverTask only, it reads the headers under mut_msgList.
+uint32_t arcSlot, arcSeq;
+// arcSeq as of the last message put in the page, storeSave->arc gets it
+// once the page is in flash.  ArchiverTask only.
+uint32_t arcPaged;
+
+// how the archive is doing, for the benchmark.  Only ArchiverTask writes it
+// (and InitTask, before it exists).
+struct ArcStats{
+	uint32_t open;			// cycles Arc_open() took at power up
+	uint32_t msgs;			// messages archived since then
+	uint32_t missed;		// evicted before they could be
+};
+struct ArcStats arcStats;
+
+uint8_t arcTake(uint8_t *rec);
+void arcFlush(void);
+void clockAdd(uint32_t secs);
+void arcDumpRun(void);
+
+// Compaction.  A deleted message leaves a hole in the header table and the
+// text log until eviction gets round to it, so the oldest messages end up
+// spread thin.  CompactTask slides the messages below the holes up, newest
+// first, headers into the next slot and text up against the next blob, so
+// the holes gather at the oldest end and are handed back (hdrs.drop) in one
+// go.  Only slots the archiver is past are touched, each slot keeps its
+// sequence number whatever moves into it.  CompactTask only, under
+// mut_msgList.
+struct Compact{
+	uint8_t on;				// a pass is under way
+	uint32_t dst;			// the slot the next message moves into
+	uint32_t scan;		// slots below this one haven't been looked at yet
+	uint32_t end;			// log offset the next message's text has to end at
+};
+struct Compact cmp;
+
+// what it's done since power up, for the benchmark.  Only CompactTask writes it.
+struct CmpStats{
+	uint32_t moves;			// messages moved
+	uint32_t bytes;			// text moved
+	uint32_t freed;			// slots handed back
+};
+struct CmpStats cmpStats;
+
+uint8_t cmpStep(void);
+uint8_t cmpMove(uint32_t src);
+
+// where the export has got to in lstStr, NULL when it's not running.
+// Protected by mut_msgList; deleting this node has to move it along.
+ListNode *exportNext = NULL;
+
+// how the last export went, for benchmarking.  Only ExportTask writes it.
+struct ExportStats{
+	uint32_t msgs;			// messages sent
+	uint32_t bytes;			// bytes sent
+	uint32_t ticks;			// how long it took
+};
+struct ExportStats exportStats;
+
+uint16_t exportLine(uint8_t *line, NodeData *data);
+void benchRun(void);
+uint32_t benchWalk(uint32_t n, uint8_t how);
+uint8_t benchNum(uint8_t *p, uint32_t v);
+uint32_t benchGlyphs(uint8_t cached);
+void searchRun(void);
+uint8_t textHas(uint8_t *text, uint8_t cnt, uint8_t *want, uint8_t len);
+uint8_t findValid(uint32_t i);
+
+// display timing, in CPU cycles.  Written under mut_LCD.
+struct PrintStats{
+	uint32_t decode;		// worst seen getting one line's text ready to draw
+	uint32_t glyph;			// the last single character draw
+	uint32_t print;			// the last whole printToScreen()
+	uint32_t cells;			// and how many cells it actually had to draw
+	uint32_t hold;			// longest DisplayTask has held mut_LCD
+	uint32_t flush;			// the last FlushTask copy to the LCD, under mut_panel
+};
+struct PrintStats printStats;
 
 void SerialInit(void);
 
@@ -124,16 +469,16 @@ int main(void){
 // initialization task
 
 __task void InitTask(void){
+	uint32_t start, first;
 
 	// initialize mutexes
 	os_mut_init(&mut_osTimestamp);
 	os_mut_init(&mut_cursor);
 	os_mut_init(&mut_LCD);
-	
-	// the message input queue
-	lstRXQ.count = 0;
-	lstRXQ.first = NULL;
-	lstRXQ.last = NULL;
+	os_mut_init(&mut_panel);
+
+	// serial output goes through the interrupt driven TX ring from here on
+	SER_InitTx();
 	
 	// the storage list
 	os_mut_init(&mut_msgList);
@@ -143,23 +488,69 @@ __task void InitTask(void){
 	
 	// this is the default message to show when you don't have any friends
 	// who want you to come play in the park
-	strcpy((char*)dfltMsg.data.text, "No new messages at this time.");
+#if TEXT_PACKED
+	Text_pack(dfltText, (uint8_t*)"No new messages at this time.", 29);
+	dfltMsg.data.text = dfltText;
+#else
+	dfltMsg.data.text = (uint8_t*)"No new messages at this time.";
+#endif
 	dfltMsg.data.cnt = 29;
 
-	// initialize box for receive queue
-	_init_box(poolRXQ, sizeof(poolRXQ), sizeof(ListNode));
+	// cycle counter, for the benchmarks and display timing
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	// glyphs get drawn from the bottom of the SRAM, and fills and copies to
+	// the LCD go by DMA with the task drawing asleep
+	GLCD_GlyphCache((uint16_t *)mySRAM_BASE, GLYPH_CACHE);
+	NVIC->ISER[DMA2_Stream0_IRQn / 32] = (uint32_t)1 << (DMA2_Stream0_IRQn % 32); // enable LCD DMA IRQ
+	NVIC->IP[DMA2_Stream0_IRQn] = 0xE0;
+	GLCD_InitDMA();
 
 	// This is best part.
-	// Give it the pool start (mySRAM_BASE).
-	// The size of the box, which is 1000*sizeof(ListNode) plus some overhead.
-	// Box size is the sizeof(ListNode).
-	// Math taken from the _declare_box() macro for overhead and alignment calcs.
-	// Last mul by 4 is to account for the chip having addressing by 4-byte words
-	// and SRAM going by byte.
-	_init_box(Storage, (((sizeof(ListNode)+3) / 4)*(1000) + 3) * 4, sizeof(ListNode));
+	// Give the log everything from STORE_BASE to the end of however much of
+	// the configured SRAM is really there.
+	storeSize = SRAM_Size(mySRAM_SIZE) - (STORE_BASE - mySRAM_BASE);
+	if (storeSize > STORE_SIZE){
+		storeSize = STORE_SIZE;
+	}
+	hdrs.slot = (ListNode *)STORE_BASE;
+	hdrs.slots = storeSize / STORE_HDR_SHARE / sizeof(ListNode) / TIME_SAMPLE * TIME_SAMPLE;	// whole time samples, and so search chunks
+	hdrs.head = 0;
+	hdrs.used = 0;
+	hdrs.drop = 0;
+	PosIndex_init(&msgIdx, posBits, posTree, hdrs.slots);
+	Tri_init(&triIdx, hdrs.slot + hdrs.slots, hdrs.slots / TRI_CHUNK);	// search index after the headers,
+	MsgLog_init(&Storage, (uint8_t *)(hdrs.slot + hdrs.slots) + Tri_size(triIdx.chunks),	// text gets the rest
+		storeSize - hdrs.slots * sizeof(ListNode) - Tri_size(triIdx.chunks));
+
+	// and whatever was in it before a reset is still there
+	start = DWT->CYCCNT;
+	recoverStats.how = storeRecover();
+	recoverStats.cycles = DWT->CYCCNT - start;
+	recoverStats.msgs = lstStr.count;
+	storeClean();
+	recoverReport();
 
-	// initialize mailboxes
-	os_mbx_init(&mbx_MsgBuffer, sizeof(mbx_MsgBuffer));
+	// the flash archive, which carries on after the last message it had in
+	// flash if that's still stored, otherwise only gets what's committed from here on
+	start = DWT->CYCCNT;
+	Arc_open(&archive);
+	arcStats.open = DWT->CYCCNT - start;
+	arcSlot = (hdrs.head + hdrs.used) % hdrs.slots;
+	arcSeq = storeSeq;
+	if (hdrs.used != 0){
+		first = hdrs.slot[hdrs.head].data.seq;
+		if (storeSave->arc - first < storeSeq - first){	// still there
+			arcSlot = (hdrs.head + storeSave->arc - first) % hdrs.slots;
+			arcSeq = storeSave->arc;
+		}
+	}
+	arcPaged = arcSeq;
+	storeSave->arc = arcSeq;
+
+	// blank the frame, all of it goes to the LCD when FlushTask starts
+	lcdClear(Black);
 
 	// initialize tasks
 	idTimerTask = os_tsk_create(TimerTask, 190);	// Timer task is relatively important.
@@ -167,8 +558,11 @@ __task void InitTask(void){
 	idClockTask = os_tsk_create(ClockTask, 189);	// high prio since we need to timestamp messages
 	idTextRX = os_tsk_create(TextRX, 200);				// the most important thing this program does
 	idDispTask = os_tsk_create(DisplayTask, 100);	// we can tolerate some lag on display output
+	idExportTask = os_tsk_create(ExportTask, 90);	// bulk dump, only runs when nothing else wants to
+	idArchiverTask = os_tsk_create(ArchiverTask, 80);	// flash can wait even longer
+	idCompactTask = os_tsk_create(CompactTask, 1);			// and tidying up can wait for ever
+	idFlushTask = os_tsk_create(FlushTask, 95);		// the LCD catches up once the drawing's done
 
-	GLCD_Clear(Black);
 	os_evt_set(joyDir, idDispTask);		// these two are to make these tasks run on wakeup
 	os_evt_set(timer1Hz, idClockTask);// once to draw the entire screen.
 	
@@ -185,21 +579,54 @@ __task void DisplayTask(void){
 	uint8_t stime[] = "00:00:00";	// time string pointer to give to time string construction function
 	uint16_t flags;
 	uint8_t delMode = FALSE;
-	uint8_t select = FALSE;
+	uint8_t select = DEL_NO;
+	uint8_t findMode = FALSE;	// up/down step through the search hits instead
+	uint32_t findAt = 0, i, held;
+	uint32_t findOf = 0;	// found.searches of the hits being stepped through
 	for (;;){
-		os_evt_wait_or(dispUser | newMsg, 0xffff);	// waits on either the user input or a new message
+		os_evt_wait_or(dispUser | newMsg | dispJump | dispSeek | dispFind, 0xffff);	// waits on either the user input or a new message
 		flags = os_evt_get();
 		
 		// reserve the message list (to read a new message possibly), the cursor, and the screen
 		os_mut_wait(&mut_msgList, 0xFFFF);
 		os_mut_wait(&mut_cursor, 0xffff);
 		os_mut_wait(&mut_LCD, 0xffff);
+		held = DWT->CYCCNT;
 		
+		if (findMode && findOf != found.searches){	// another search is refilling the hits under us
+			findMode = FALSE;
+		}
+		if ((flags & dispFind) && !delMode){	// a search finished, show the first hit still there
+			findMode = FALSE;
+			for (i = 0; i < found.count; i++){
+				if (findValid(i)){
+					findMode = TRUE;
+					findOf = found.searches;
+					findAt = i;
+					cursor.msg = &hdrs.slot[found.slot[i]];
+					cursor.row = 0;
+					break;
+				}
+			}
+		}
 		if(!delMode && !(flags & joyPush)){	// if in normal mode, and not entering delete mode
 			if(lstStr.count != 0){		// if there are messages from your buddies
-				if(lstStr.count == 1){	// if there is only one thing to display
+				if(lstStr.count == 1 || cursor.msg == NULL){	// if there is only one thing to display
 					cursor.msg = lstStr.last;	// point us at the tail (where new messages are pushed)
 				}
+				if (flags & dispJump){	// asked for a message by position
+					if (jumpTo >= 1 && jumpTo <= lstStr.count){
+						cursor.msg = msgAt(jumpTo - 1);
+						cursor.row = 0;
+					}
+				}
+				if (flags & dispSeek){	// asked for a message by time
+					cursor.msg = timeSeek(&seekTo);
+					if (cursor.msg == NULL){	// nothing that late, show the newest
+						cursor.msg = lstStr.last;
+					}
+					cursor.row = 0;
+				}
 				switch (flags & dispUser){	// handle button pushing
 					case JOY_RIGHT:	// cursor down
 						// Scroll down in the message until we can see lines 6-10, no roll.
@@ -212,7 +639,14 @@ __task void DisplayTask(void){
 						cursor.row = cursor.row == 0 ? 0 : (cursor.msg->data.cnt / 16) > 4 ? (cursor.row+6)%7 : 0;
 						break;
 					case JOY_UP: // cursor right
-						if(cursor.msg->next != NULL){	// can we even go next?
+						if (findMode){	// next hit that's still there
+							for (i = findAt + 1; i < found.count && !findValid(i); i++);
+							if (i < found.count){
+								findAt = i;
+								cursor.msg = &hdrs.slot[found.slot[i]];
+								cursor.row = 0;
+							}
+						} else if(cursor.msg->next != NULL){	// can we even go next?
 							cursor.msg = cursor.msg->next;
 							cursor.row = 0;	// resets to top of msg so you don't get confused, 
 							// only happens if there's another message to see 
@@ -220,7 +654,14 @@ __task void DisplayTask(void){
 						}
 						break;
 					case JOY_DOWN: // cursor left
-						if(cursor.msg->prev != NULL){	// can we go backward?
+						if (findMode){	// previous hit that's still there
+							for (i = findAt; i > 0 && !findValid(i - 1); i--);
+							if (i > 0){
+								findAt = i - 1;
+								cursor.msg = &hdrs.slot[found.slot[i - 1]];
+								cursor.row = 0;
+							}
+						} else if(cursor.msg->prev != NULL){	// can we go backward?
 							cursor.msg = cursor.msg->prev;
 							cursor.row = 0;
 						}
@@ -232,61 +673,68 @@ __task void DisplayTask(void){
 				printToScreen(stime, 0, &dfltMsg);
 			}
 			
+		} else if ((flags & joyPush) && !delMode && findMode){	// center leaves find mode
+			findMode = FALSE;
 		} else if((flags & joyPush) && !delMode && lstStr.count > 0){	// if entering delete mode with a message
 			delMode = TRUE;
-			// display the DELETE? YES/NO messages
-			GLCD_SetTextColor(White);
-			GLCD_SetBackColor(Black);
-			GLCD_DisplayString(8,0,1,(uint8_t*)"Delete Msg?");
-			GLCD_DisplayString(9,0,1,(uint8_t*)"Yes");
-			GLCD_SetTextColor(Black);
-			GLCD_SetBackColor(Red);
-			GLCD_DisplayString(9,4,1,(uint8_t*)"No");
-			select = FALSE;
-		} else if (!(flags & joyPush) && delMode && lstStr.count > 0){ // if navigating in delete mode
-			// swap between YES and NO
-			select = select == FALSE ? TRUE : FALSE;
-			// visually swap too
-			if (select){
-				GLCD_SetTextColor(Black);
-				GLCD_SetBackColor(Red);
-				GLCD_DisplayString(9,0,1,(uint8_t*)"Yes");
-				GLCD_SetTextColor(White);
-				GLCD_SetBackColor(Black);
-				GLCD_DisplayString(9,4,1,(uint8_t*)"No");
+			// display the DELETE? YES/NO/OLD/ALL messages
+			lcdColor(White, Black);
+			lcdString(7,0,(uint8_t*)"Delete Msg?");
+			select = DEL_NO;
+			printDelMenu(select);
+		} else if ((flags & joyDir) && delMode && lstStr.count > 0){ // if navigating in delete mode
+			// step through the choices, right/up forward and left/down back
+			if (flags & (JOY_RIGHT | JOY_UP)){
+				select = (select + 1) % DEL_CHOICES;
 			} else {
-				GLCD_SetTextColor(White);
-				GLCD_SetBackColor(Black);
-				GLCD_DisplayString(9,0,1,(uint8_t*)"Yes");
-				GLCD_SetTextColor(Black);
-				GLCD_SetBackColor(Red);
-				GLCD_DisplayString(9,4,1,(uint8_t*)"No");
-			}
-		} else if ((flags & joyPush) && delMode && lstStr.count > 0){ // if confirming choice.
-			if (select){ // if we're deleting the message
-				ListNode *delnode = List_remove(&lstStr, cursor.msg);
-				// try to go one way, and then check the other, and if nothing, NULL.
-				cursor.msg = delnode->prev ? delnode->prev : delnode->next ? delnode->next : NULL;
+				select = (select + DEL_CHOICES - 1) % DEL_CHOICES;
+			}
+			printDelMenu(select);
+		} else if ((flags & joyPush) && delMode){ // if confirming choice.
+			if (cursor.msg != NULL && lstStr.count > 0){
+				storeDirty();
+				switch (select){
+					case DEL_ONE:{ // if we're deleting the message
+						ListNode *delnode = cursor.msg;
+						msgUnlink(delnode);
+						delnode->data.flags = MSG_DEAD;	// space comes back when the store gets round to it
+						os_evt_set(cmpKick, idCompactTask);	// or sooner
+						break;
+					}
+					case DEL_OLDER:
+						msgDropBefore(cursor.msg);
+						break;
+					case DEL_ALL:
+						msgDropBefore(NULL);
+						break;
+				}
+				storeClean();
 			}
 			delMode = FALSE;
-			select = FALSE;
-			GLCD_SetBackColor(Black);
-			GLCD_SetTextColor(White);
-			GLCD_DisplayString(8,0,1,(uint8_t *)"           ");
-			GLCD_DisplayString(9,0,1,(uint8_t *)"   ");
-			GLCD_DisplayString(9,4,1,(uint8_t *)"  ");
+			select = DEL_NO;
+			lcdColor(White, Black);
+			lcdString(7,0,(uint8_t *)"           ");
+			lcdString(8,0,(uint8_t *)"              ");
 			os_evt_set(newMsg, idDispTask);
 		}
 		
 		// diplaying the number of total messages in storage
-		GLCD_SetTextColor(White);
-		GLCD_SetBackColor(Black);
+		lcdColor(White, Black);
 		
-		GLCD_DisplayChar(0,17,1,lstStr.count%10+0x30);
-		GLCD_DisplayChar(0,16,1,(lstStr.count/10%10)+0x30);
-		GLCD_DisplayChar(0,15,1,lstStr.count/100%10+0x30);
-		GLCD_DisplayChar(0,14,1,lstStr.count/1000%10+0x30);
+		printCount(0, lstStr.count);
+		// and which one of them we're looking at, underneath
+		lcdString(1,0,(uint8_t *)(findMode ? "Find    /   " : "            "));
+		if (findMode){	// which hit of how many
+			printFind(findAt + 1, 5);
+			printFind(found.count, 9);
+		}
+		lcdChar(1,12,'#');
+		printCount(1, lstStr.count != 0 && cursor.msg != NULL ? msgPos(cursor.msg) : 0);
 		
+		held = DWT->CYCCNT - held;
+		if (held > printStats.hold){
+			printStats.hold = held;
+		}
 		os_mut_release(&mut_msgList);
 		os_mut_release(&mut_cursor);
 		os_mut_release(&mut_LCD);
@@ -304,23 +752,229 @@ __task void DisplayTask(void){
 *
 */
 void printToScreen(uint8_t time[], uint8_t pos, ListNode* dispNode){
-	uint8_t i=0;
+	static uint8_t text[17];	// one line, unpacked, padded with spaces to draw
+	uint8_t i=0, line, n, from;
 	uint8_t lineOffset=3;	// beginning positions on screen
 	uint8_t colOffset=2;
-	for(i=0;i<64;i++){	// we can only print 4 lines of 16 char (64 char)
-		if((i+pos*16)<dispNode->data.cnt){	// if the character we're trying to print lies within the message bounds
-			GLCD_SetTextColor(White);
-			GLCD_SetBackColor(Black);
-			// give the row, column, and character to display.
-			GLCD_DisplayChar((i/16)+lineOffset, (i%16)+colOffset, 1, dispNode->data.text[i+pos*16]);
-		} else {	// if we're outside the bounds of the message.
-			GLCD_DisplayChar((i/16)+lineOffset, (i%16)+colOffset, 1, *" ");
+	uint32_t start, whole = DWT->CYCCNT, drawn = shadow.drawn;
+	uint8_t cnt = dispNode->data.cnt;
+#if TEXT_PACKED
+	TextCursor tc;
+#endif
+	lcdColor(White, Black);
+	start = DWT->CYCCNT;	// the first line pays for skipping to it
+#if TEXT_PACKED
+	Text_seek(&tc, dispNode->data.text, pos*16 < cnt ? pos*16 : cnt);
+#endif
+	for(line=0;line<4;line++){	// we can only print 4 lines of 16 char (64 char)
+		from = pos*16 + line*16;
+		n = from >= cnt ? 0 : cnt - from > 16 ? 16 : cnt - from;	// how much of the message lies on this line
+		// only the characters on this line get unpacked, just before they're drawn
+#if TEXT_PACKED
+		Text_read(&tc, text, n);
+#else
+		memcpy(text, dispNode->data.text + from, n);
+#endif
+		start = DWT->CYCCNT - start;
+		if (start > printStats.decode){
+			printStats.decode = start;
+		}
+		// a space past the end of the message, and scrolling a line only
+		// redraws the cells that differ from what's there
+		for(i=n;i<16;i++){
+			text[i] = ' ';
 		}
+		text[16] = 0;
+		lcdString(line+lineOffset, colOffset, text);
+		start = DWT->CYCCNT;
 	}
 	// interpret and display time.
 	timeToString(time, &(dispNode->data.time));
-	GLCD_DisplayString(9,12,1,time);
+	lcdString(9,12,time);
+	printStats.print = DWT->CYCCNT - whole;
+	printStats.cells = shadow.drawn - drawn;
+}
+/*
+*	printDelMenu(), the delete choices with the selected one highlighted.
+*	@select 	is DEL_NO, DEL_ONE, DEL_OLDER or DEL_ALL
+*/
+void printDelMenu(uint8_t select){
+	static const char *label[DEL_CHOICES] = {"No", "Yes", "Old", "All"};
+	static const uint8_t col[DEL_CHOICES] = {0, 3, 7, 11};	// left to right in the order the joystick steps through them
+	uint8_t i;
+	for (i = 0; i < DEL_CHOICES; i++){
+		if (i == select){
+			lcdColor(Black, Red);
+		} else {
+			lcdColor(White, Black);
+		}
+		lcdString(8,col[i],(uint8_t *)label[i]);
+	}
+}
+
+/*
+*	printCount(), a 5 digit number in the top right, where the count goes.
+*	@row 	is the screen row
+*	@n 		is the number
+*/
+void printCount(uint8_t row, uint32_t n){
+	uint8_t digits[6];
+	digits[4] = n%10+0x30;
+	digits[3] = (n/10%10)+0x30;
+	digits[2] = n/100%10+0x30;
+	digits[1] = n/1000%10+0x30;
+	digits[0] = n/10000%10+0x30;	// the SRAM holds tens of thousands
+	digits[5] = 0;
+	lcdString(row,13,digits);
+}
+
+/*
+*	printFind(), a 3 digit number on row 1, for the search hits.
+*	@n 		is the number
+*	@col 	is where it starts
+*/
+void printFind(uint32_t n, uint8_t col){
+	uint8_t digits[4];
+	digits[0] = n/100%10+0x30;
+	digits[1] = n/10%10+0x30;
+	digits[2] = n%10+0x30;
+	digits[3] = 0;
+	lcdString(1,col,digits);
+}
+
+/*
+*	lcdColor(), the colours the next cells go on in.
+*	@text 	is the character colour
+*	@back 	is the background
+*/
+void lcdColor(uint16_t text, uint16_t back){
+	shadow.textColor = text;
+	shadow.backColor = back;
+	GLCD_SetTextColor(text);
+	GLCD_SetBackColor(back);
+}
+
+/*
+*	lcdChar(), one font 1 character, unless the cell has it already.
+*	@row 	is the screen row
+*	@col 	is the screen column
+*	@c 		is the character
+*/
+void lcdChar(uint8_t row, uint8_t col, uint8_t c){
+	if (lcdCell(row, col, c)){
+		os_evt_set(flushKick, idFlushTask);
+	}
+}
+
+/*
+*	lcdString(), lcdChar() along a zero terminated string, FlushTask only
+*	gets told once.
+*	@row 	is the screen row
+*	@col 	is where it starts
+*	@s 		is the string
+*/
+void lcdString(uint8_t row, uint8_t col, uint8_t *s){
+	uint8_t drawn = 0;
+	while (*s && col < LCD_COLS){
+		drawn |= lcdCell(row, col++, *s++);
+	}
+	if (drawn){
+		os_evt_set(flushKick, idFlushTask);
+	}
+}
+
+/*
+*	lcdCell(), a character into the frame and the cell marked for FlushTask,
+*	unless it's there already.
+*	@row 	is the screen row
+*	@col 	is the screen column
+*	@c 		is the character
+*	returns 1 if it had to be drawn
+*/
+uint8_t lcdCell(uint8_t row, uint8_t col, uint8_t c){
+	uint32_t start;
+	if (lcdHas(row, col, c)){
+		return 0;
+	}
+	start = DWT->CYCCNT;
+	GLCD_RenderChar(lcdFrame + row * CELL_H * LCD_WIDTH + col * CELL_W, LCD_WIDTH, 1, c);
+	printStats.glyph = DWT->CYCCNT - start;
+	shadow.c[row][col] = c;
+	shadow.text[row][col] = shadow.textColor;
+	shadow.back[row][col] = shadow.backColor;
+	shadow.dirty[row] |= 1UL << col;
+	shadow.drawn++;
+	return 1;
+}
+
+/*
+*	lcdHas(), whether a cell already shows a character in the current colours.
+*	A space is all background, whatever colour it was drawn with.
+*/
+uint8_t lcdHas(uint8_t row, uint8_t col, uint8_t c){
+	return shadow.c[row][col] == c && shadow.back[row][col] == shadow.backColor
+			&& (c == ' ' || shadow.text[row][col] == shadow.textColor);
+}
+
+/*
+*	lcdClear(), the whole frame to one colour, and the grid to spaces on it.
+*	Nothing's kicked, it's only done before FlushTask starts.
+*	@color 	is the colour
+*/
+void lcdClear(uint16_t color){
+	uint32_t i;
+	uint8_t row, col;
+	for (i = 0; i < LCD_WIDTH * LCD_HEIGHT; i++){
+		lcdFrame[i] = color;
+	}
+	for (row = 0; row < LCD_ROWS; row++){
+		for (col = 0; col < LCD_COLS; col++){
+			shadow.c[row][col] = ' ';
+			shadow.text[row][col] = color;
+			shadow.back[row][col] = color;
+		}
+		shadow.dirty[row] = DIRTY_ROW;
+	}
+}
+
+/*
+*	flushRun(), copies the cells drawn in the frame since last time to the
+*	LCD, each run of them along a row (or of whole rows) through one window.
+*	mut_LCD is only held to take the dirty bits, so a cell drawn again while
+*	it's being copied just gets marked again and goes next time.
+*/
+void flushRun(void){
+	static uint32_t dirty[LCD_ROWS];
+	uint32_t start;
+	uint8_t row, col, top, end;
+	os_mut_wait(&mut_LCD, 0xffff);
+	for (row = 0; row < LCD_ROWS; row++){
+		dirty[row] = shadow.dirty[row];
+		shadow.dirty[row] = 0;
+	}
+	os_mut_release(&mut_LCD);
+	os_mut_wait(&mut_panel, 0xffff);
+	start = DWT->CYCCNT;
+	for (row = 0; row < LCD_ROWS; row++){
+		if (dirty[row] == DIRTY_ROW){	// whole rows are back to back in the frame
+			for (top = row; row + 1 < LCD_ROWS && dirty[row + 1] == DIRTY_ROW; row++);
+			GLCD_Blit(0, top * CELL_H, LCD_WIDTH, (row - top + 1) * CELL_H,
+				lcdFrame + top * CELL_H * LCD_WIDTH, LCD_WIDTH);
+			continue;
+		}
+		for (col = 0; col < LCD_COLS; col++){
+			if (dirty[row] & (1UL << col)){
+				for (end = col; end + 1 < LCD_COLS && (dirty[row] & (1UL << (end + 1))); end++);
+				GLCD_Blit(col * CELL_W, row * CELL_H, (end - col + 1) * CELL_W, CELL_H,
+					lcdFrame + row * CELL_H * LCD_WIDTH + col * CELL_W, LCD_WIDTH);
+				col = end;
+			}
+		}
+	}
+	printStats.flush = DWT->CYCCNT - start;
+	os_mut_release(&mut_panel);
 }
+
 /*
 *	timeToString(), helper function to turn message and OS timestamps into a string format
 *	@time[] 		char array which will be displayed
@@ -378,6 +1032,15 @@ __task void ClockTask(void){
 			flags = os_evt_get();		// clear and get new flag, in case a button and 1Hz
 															// happened at the same time
 			os_mut_release(&mut_osTimestamp);
+
+			// sample ingest throughput, messages committed in the last second
+			os_mut_wait(&mut_msgList, 0xffff);
+			rxStats.rate = rxStats.msgs - rxStats.lastMsgs;
+			rxStats.lastMsgs = rxStats.msgs;
+			if (rxStats.rate > rxStats.peakRate){
+				rxStats.peakRate = rxStats.rate;
+			}
+			os_mut_release(&mut_msgList);
 		}
 		if (flags & hourButton){	// hour button, increment and roll, no overflow
 			os_mut_wait(&mut_osTimestamp, 0xffff);
@@ -401,10 +1064,9 @@ __task void ClockTask(void){
 		os_mut_wait(&mut_osTimestamp, 0xffff);
 		os_mut_wait(&mut_LCD,0xffff);
 		
-		GLCD_SetBackColor(Black);
-		GLCD_SetTextColor(White);
+		lcdColor(White, Black);
 		timeToString(time,&osTimestamp);
-		GLCD_DisplayString(0, 0, 1, time);
+		lcdString(0, 0, time);
 		
 		os_mut_release(&mut_osTimestamp);
 		os_mut_release(&mut_LCD);
@@ -445,91 +1107,1837 @@ __task void JoystickTask(void){
 
 /*
 *		Test Rx handling.
-*		waits for the ISR to put a completed message in the mailbox,
-*		and then copies the information over to the 
+*		All the framing and key parsing happens here in task context; the ISRs
+*		only move raw bytes.  Characters are written straight into a storage
+*		node reserved ahead of time, so a finished message is committed by
+*		pointer without being copied.  Finished messages are collected in a
+*		local batch and the whole batch is committed once the available
+*		input is drained, so a flood costs one lock round trip per burst.
+*		In RX_MODE_IRQ, drains the byte ring the USART3 ISR fills.
+*		In RX_MODE_DMA, gets woken up when the line goes idle (or the DMA buffer
+*		is half/all the way full) and parses everything the DMA has written since
+*		last time, so the parsing cost is paid once per burst.
 */
 __task void TextRX(void){
-	static ListNode	*newmsg;
-	static ListNode *message;
+	uint8_t stalled;						// out of storage, input left where it is
+#if RX_MODE == RX_MODE_DMA
+	uint32_t wrIdx;
+#else
+	uint8_t data;
+#endif
+	rx.mode = RXMODE_TEXT;			// interactive typing until told otherwise
+	rx.typing.text = rxText;
+	Frame_init(&rx.frame);
 	for (;;){
-		os_mbx_wait(&mbx_MsgBuffer, (void **)&newmsg, 0xffff);
-		os_mut_wait(&mut_osTimestamp, 0xffff);
-		os_mut_wait(&mut_msgList, 0xffff);
-
-		message = _alloc_box(Storage);
-		message->data = newmsg->data;		// I'm so happy this works the way I expected.
-		message->data.time = osTimestamp;	// time = stamped
-		List_push(&lstStr, message);		// put our thing as the most recent message
-		_free_box(poolRXQ, newmsg);			// free up the memory used for the mailbox
-		os_evt_set(newMsg, idDispTask);
-
-		os_mut_release(&mut_osTimestamp);
-		os_mut_release(&mut_msgList);
+		// a frame that stops half way through is given up on after a while, so
+		// a lost byte can't swallow whatever comes next
+		if (os_evt_wait_or(txtRx, FRAME_TIMEOUT) == OS_R_TMO){
+			if (Frame_busy(&rx.frame)){
+				rxFrameDone(Frame_abort(&rx.frame));
+			}
+			rxFlow(0);	// quiet line, let the sender go again
+			continue;
+		}
+		do {
+			stalled = !rxReserve();	// a message finished last time round may still need storing
+#if RX_MODE == RX_MODE_DMA
+			wrIdx = SER_RxDMAIndex(RX_DMA_SIZE);	// everything up to here is a complete span
+			rxDMALap(wrIdx);
+			while (!stalled && rxDMARead != wrIdx){
+				if (!rxByte(rxDMABuf[rxDMARead])){
+					stalled = TRUE;
+					break;
+				}
+				rxDMARead = (rxDMARead + 1) % RX_DMA_SIZE;
+				rxDMAParsed++;
+			}
+			stalled = stalled || !rxReserve();	// store a message the last byte finished
+			commitBatch(&rx.batch);
+			rxFlow((SER_RxDMAIndex(RX_DMA_SIZE) - rxDMARead) % RX_DMA_SIZE);
+#else
+			while (!stalled && Ring_peek(&rxRing, &data)){	// drain everything the ISR has put so far
+				if (!rxByte(data)){
+					stalled = TRUE;
+					break;
+				}
+				Ring_skip(&rxRing);
+			}
+			stalled = stalled || !rxReserve();	// store a message the last byte finished
+			commitBatch(&rx.batch);
+			rxFlow(Ring_used(&rxRing));
+#endif
+			if (stalled){	// the whole store is messages not committed yet, can't evict any
+				os_dly_wait(FLOW_POLL);
+			}
+		} while (stalled);
 	}
 }
 
+#if RX_MODE == RX_MODE_DMA
+/*
+*	rxDMALap(), counts what the DMA wrote over before TextRX got to it.  Where
+*	the DMA is now is within half a buffer of rxDMAWritten, so between them
+*	they say how far along the stream it is, and so how far along the bytes
+*	from rxDMARead up to it are.  Any gap between there and what's been
+*	parsed was lost, and so is the frame it was in.
+*	@wrIdx 	is SER_RxDMAIndex()
+*/
+void rxDMALap(uint32_t wrIdx){
+	uint32_t at = rxDMAWritten;
+	at += (wrIdx - at + RX_DMA_SIZE / 2) % RX_DMA_SIZE - RX_DMA_SIZE / 2;	// the DMA's place in the stream
+	at -= (wrIdx - rxDMARead) % RX_DMA_SIZE;	// and rxDMARead's
+	if (at != rxDMAParsed + rxDMALost){
+		rxDMALost = at - rxDMAParsed;
+		if (Frame_busy(&rx.frame)){
+			rxFrameDone(Frame_abort(&rx.frame));
+		}
+	}
+}
+#endif
 
 /*
-*		Serial Initialization and ISR
+*	rxFlow(), XOFF once the receive backlog passes its high water mark, XON
+*	once it's back under the low water mark.  The ISRs send the XOFF
+*	themselves, in case TextRX is held up.  Storage never fills, it evicts.
+*	@backlog 	is how many received bytes are waiting to be parsed
 */
+void rxFlow(uint32_t backlog){
+	if (backlog >= RX_HIGH_WATER){
+		SER_FlowOff(SER_FLOW_RX);
+	} else if (backlog <= RX_LOW_WATER){
+		SER_FlowOn(SER_FLOW_RX);
+	}
+}
 
-void SerialInit(void){
-	SER_Init();
-	NVIC->ISER[USART3_IRQn / 32] = (uint32_t)1 << (USART3_IRQn % 32); // enable USART3 IRQ
-	NVIC->IP[USART3_IRQn] = 0xE0; // set priority for USART3 to 0xE0
-	USART3->CR1 |= USART_CR1_RXNEIE; // enable device interrupt for data received and ready to read
+/*
+*	rxReserve(), gets the storage the next byte could need before it's read:
+*	a record for a typed message that just finished, and room for a full
+*	length message in case the byte finishes a frame message.
+*	returns FALSE if storage can't be had, in which case nothing more can be read
+*/
+uint8_t rxReserve(void){
+	ListNode *node;
+	if (rx.pend){	// typed text is stored now its length is known
+		node = storeMsg(rxText, rx.typing.cnt);
+		if (node == NULL){
+			return FALSE;
+		}
+		List_push(&rx.batch, node);
+		rx.pend = FALSE;
+	}
+	return storeMakeRoom(TEXT_BYTES_MAX);
 }
 
+/*
+*	rxByte(), sends one received byte either to the frame decoder or to the
+*	text parser.  Whatever storage the byte could need is reserved first; if
+*	there isn't any the byte is left unread.
+*	@data 	is the received byte
+*	returns FALSE if the byte couldn't be taken because storage is full
+*/
+uint8_t rxByte(uint8_t data){
+	uint8_t result;
+	if (!rxReserve()){
+		return FALSE;
+	}
+	result = Frame_rx(&rx.frame, data);
+	switch (result){
+		case FRAME_NOTFRAME:	// plain typing, ignored when only frames are expected
+			if (rx.mode != RXMODE_TEXT){
+				break;
+			}
+			if (rxParseChar(&rx.typing, &rx.count, data)){
+				rx.pend = TRUE;	// gets stored before the next byte is read
+			}
+			break;
+		case FRAME_PAYLOAD:
+			rxPayload(data);
+			break;
+		case FRAME_GOOD:
+		case FRAME_BAD:
+			rxFrameDone(result);
+			break;
+	}
+	return TRUE;
+}
 
 /*
-*		Ingress point for data.  Does sizing calculations, key parsing, and 
-*		determines when to send the data on to the rest of the program.
-*		It's a little bulky for an ISR, but it works on a relatively
-*		high serial baud rate, even with ~100 pages of copy-pasted
-*		text thrown directly into PuTTY.  So, we're satisfied overall.
+*	rxPayload(), one payload byte of the frame in progress.  Bulk message
+*	text is collected like typed text and stored once it's all in.
+*	@data 	is the payload byte
 */
-void USART3_IRQHandler(void){
-	static uint8_t data;	// static to keep a running tally
-	static NodeData databuff;	// static buffer that just gets used over and over
-	static uint8_t countData = 0;	// our place in the buffer
-	static uint8_t sendflag = FALSE;
-	static ListNode *rxnode;
-
-	uint8_t flag = USART3->SR & USART_SR_RXNE; // make a flag for the USART data buffer full & ready to read signal
-
-	if (flag == USART_SR_RXNE){	// if the flag is set.  If not, do nothing.
-		data = SER_GetChar();
-		if (isr_mbx_check(mbx_MsgBuffer) > 0){
-			if (data >= 0x20 && data <= 0x7E){	// exclude the backspace key, include space.
-				databuff.text[countData] = data; // store serial input to data buffer
-				countData++;
-				if (countData == 160){	// if we've filled a page
-					databuff.cnt = countData;	// record the size of the message
-					countData = 0;	// reset the buffer data
-					// send to mailbox
-					sendflag = TRUE;
-				}
-			}else if (data == 0x7F){ // backspace character
-				countData = (countData + 159) % 160;	// move the cursor back one, and clamp at zero
-
-			}else if (data == 0x0D){ // return
-				databuff.cnt = countData;
-				if(countData >0){	// send to mailbox, reset index
-					sendflag = TRUE;
-					countData = 0;
+void rxPayload(uint8_t data){
+	ListNode *node;
+	if (rx.frameErr){	// already know this one is going in the bin
+		return;
+	}
+	if (rx.frame.type == FRAME_MSGS){
+		if (rx.msgLeft == 0){	// length of the next message
+			if (data == 0 || data > 160){
+				rx.frameErr = TRUE;
+				return;
+			}
+			rx.fcnt = 0;
+			rx.msgLeft = data;
+		} else {
+			// same character rules as typing, anything unprintable shows as '?'
+			rx.ftext[rx.fcnt++] = (data >= 0x20 && data <= 0x7E) ? data : '?';
+			if (--rx.msgLeft == 0){
+				node = storeMsg(rx.ftext, rx.fcnt);	// rxByte() made sure there's room
+				if (node == NULL){
+					rx.frameErr = TRUE;
+					return;
 				}
-				
-				
+				List_push(&rx.frameMsgs, node);
 			}
+		}
+	} else if (rx.frame.type == FRAME_CMD){
+		if (rx.cmdLen < sizeof(rx.cmd)){
+			rx.cmd[rx.cmdLen++] = data;
+		} else {
+			rx.frameErr = TRUE;
+		}
+	} else {	// don't know that type
+		rx.frameErr = TRUE;
+	}
+}
+
+/*
+*	rxFrameDone(), a frame has ended.  A good one has its messages queued for
+*	commit or its command run, a bad one has its storage handed back.  Either
+*	way the sender gets an ACK or NAK so it knows whether to resend.
+*	@result 	is FRAME_GOOD or FRAME_BAD from the frame decoder
+*/
+void rxFrameDone(uint8_t result){
+	ListNode *node;
+	if (rx.msgLeft != 0 || rx.frameErr){	// CRC might match, but the contents don't add up
+		result = FRAME_BAD;
+	}
+	if (result == FRAME_GOOD && rx.frame.type == FRAME_MSGS){
+		List_join(&rx.batch, &rx.frameMsgs);
+	} else if (rx.frameMsgs.count != 0){
+		while ((node = List_shift(&rx.frameMsgs)) != NULL){
+			node->data.flags = MSG_DEAD;	// nobody else has seen these
+			timeMark(node, timeLast);	// keeps the time index in order
+		}
+		os_evt_set(cmpKick, idCompactTask);
+	}
+	if (result == FRAME_GOOD && rx.frame.type == FRAME_CMD){
+		rxCommand(rx.cmd, rx.cmdLen);
+	}
+	rx.msgLeft = 0;
+	rx.frameErr = FALSE;
+	rx.cmdLen = 0;
+
+	SER_Reply(result == FRAME_GOOD ? FRAME_ACK : FRAME_NAK);	// can't wait on a task holding the TX ring
+	if (rx.baud != 0){	// ACK had to go out at the old rate
+		SER_SetBaud(rx.baud);
+		rx.baud = 0;
+	}
+}
 
-			if (sendflag == TRUE){	// we're sending
-				rxnode = _alloc_box(poolRXQ);	// get some memory from the rx pool
-				strcpy((char*)rxnode->data.text, (char*)databuff.text);	// copy data into new block
-				rxnode->data.cnt = databuff.cnt;	// record how many characters we care about.
-																					// Could use \0 but eh.
-				isr_mbx_send(&mbx_MsgBuffer, rxnode);
-				sendflag = FALSE;
+/*
+*	rxCommand(), runs a command frame.
+*	@cmd* 	is the command byte followed by its arguments
+*	@len 		is how many bytes that is
+*/
+void rxCommand(uint8_t *cmd, uint8_t len){
+	Timestamp when;
+	if (len < 1){	// empty, cmd[0] is whatever the last one was
+		return;
+	}
+	switch (cmd[0]){
+		case CMD_MODE:	// [mode][baud, 4 bytes LSB first, 0 to leave it alone]
+			if (len >= 6 && cmd[1] <= RXMODE_FRAMED){
+				rx.mode = cmd[1];
+				rx.baud = cmd[2] | (cmd[3] << 8) | (cmd[4] << 16) | ((uint32_t)cmd[5] << 24);
+			}
+			break;
+		case CMD_EXPORT:	// dump the whole store, done in the background
+			os_evt_set(exportCmd, idExportTask);
+			break;
+		case CMD_BENCH:	// so is the benchmark
+			os_evt_set(benchCmd, idExportTask);
+			break;
+		case CMD_GOTO:	// [position, 4 bytes LSB first]
+			if (len >= 5){
+				jumpTo = cmd[1] | (cmd[2] << 8) | (cmd[3] << 16) | ((uint32_t)cmd[4] << 24);
+				os_evt_set(dispJump, idDispTask);
 			}
+			break;
+		case CMD_DELETE:	// [0] everything, [1][hours][minutes][seconds] older than then
+			os_mut_wait(&mut_msgList, 0xffff);
+			os_mut_wait(&mut_cursor, 0xffff);
+			storeDirty();
+			if (len >= 2 && cmd[1] == 0){
+				msgDropBefore(NULL);
+			} else if (len >= 5 && cmd[1] == 1 && cmd[2] < 24 && cmd[3] < 60 && cmd[4] < 60){
+				when.hours = cmd[2];
+				when.minutes = cmd[3];
+				when.seconds = cmd[4];
+				msgDropBefore(timeSeek(&when));	// nothing that late means everything is older
+			}
+			storeClean();
+			os_mut_release(&mut_cursor);
+			os_mut_release(&mut_msgList);
+			os_evt_set(newMsg, idDispTask);
+			break;
+		case CMD_SEEK:	// [hours][minutes][seconds]
+			if (len >= 4 && cmd[1] < 24 && cmd[2] < 60 && cmd[3] < 60){
+				seekTo.hours = cmd[1];
+				seekTo.minutes = cmd[2];
+				seekTo.seconds = cmd[3];
+				os_evt_set(dispSeek, idDispTask);
+			}
+			break;
+		case CMD_SEARCH:	// [text], done in the background
+			if (len >= 2){
+				searchLen = len - 1;
+				memcpy(searchText, cmd + 1, searchLen);
+				os_evt_set(searchCmd, idExportTask);
+			}
+			break;
+		case CMD_ARCHIVE:	// so is reading back the flash
+			os_evt_set(arcDump, idArchiverTask);
+			break;
+	}
+}
+
+/*
+*	storeAlloc(), takes the next header and a text blob, evicting old
+*	messages if it has to.  The message comes back pending, commitBatch()
+*	makes it live.
+*	@size 	is how many bytes of text it holds
+*	returns the message node with its text pointer set, NULL if there's no room
+*/
+ListNode *storeAlloc(uint8_t size){
+	ListNode *node;
+	if (!storeMakeRoom(size)){
+		return NULL;
+	}
+	node = &hdrs.slot[(hdrs.head + hdrs.used) % hdrs.slots];
+	if ((node - hdrs.slot) % TRI_CHUNK == 0){	// first into a chunk, storeMakeRoom() emptied it
+		os_mut_wait(&mut_msgList, 0xffff);
+		Tri_clearChunk(&triIdx, (node - hdrs.slot) / TRI_CHUNK);
+		os_mut_release(&mut_msgList);
+	}
+	node->data.flags = MSG_PEND;	// before the sequence number, the archiver goes by that
+	node->data.text = MsgLog_alloc(&Storage, size);
+	node->data.seq = storeSeq++;
+	hdrs.used++;
+	return node;
+}
+
+/*
+*	storeMsg(), stores a finished message's text, packed if TEXT_PACKED.
+*	@text* 	is the text
+*	@cnt 		is how many characters
+*	returns the pending message node, NULL if there's no room
+*/
+ListNode *storeMsg(uint8_t *text, uint8_t cnt){
+	ListNode *node;
+#if TEXT_PACKED
+	node = storeAlloc(Text_packedSize(text, cnt));
+	if (node != NULL){
+		Text_pack(node->data.text, text, cnt);
+	}
+#else
+	node = storeAlloc(cnt);
+	if (node != NULL){
+		memcpy(node->data.text, text, cnt);
+	}
+#endif
+	if (node != NULL){
+		node->data.cnt = cnt;
+		node->data.sig = msgSig(text, cnt);	// while it's still at hand unpacked
+	}
+	return node;
+}
+
+/*
+*	msgText(), characters out of a stored message's text, unpacked.
+*	@data* 	is the message
+*	@from 	is the first character wanted
+*	@n 			is how many, there have to be that many
+*	@dst* 	is where they go
+*/
+void msgText(NodeData *data, uint8_t from, uint8_t n, uint8_t *dst){
+#if TEXT_PACKED
+	TextCursor tc;
+	Text_seek(&tc, data->text, from);
+	Text_read(&tc, dst, n);
+#else
+	memcpy(dst, data->text + from, n);
+#endif
+}
+
+/*
+*	storeMakeRoom(), evicts the oldest messages until there's a free header
+*	(a whole free chunk of them if the next one starts a chunk, see triIdx)
+*	and a message's text fits.  Each eviction is one unlink, deleted messages
+*	are just skipped.  The log goes by the headers' text pointers, not by
+*	walking its records, since the compactor leaves gaps between them.
+*	@size 	is how many bytes of text the message will have
+*	returns FALSE if everything left is pending (not committed yet)
+*/
+uint8_t storeMakeRoom(uint8_t size){
+	ListNode *old;
+	uint8_t ok = TRUE;
+	uint32_t evicted = 0;
+	if (hdrs.slots - hdrs.used >= hdrNeed() && MsgLog_fits(&Storage, size)){
+		return TRUE;
+	}
+	os_mut_wait(&mut_msgList, 0xffff);
+	os_mut_wait(&mut_cursor, 0xffff);
+	storeDirty();
+	if (hdrs.drop != 0){	// bulk deleted messages, all handed back in one go
+		hdrs.head = (hdrs.head + hdrs.drop) % hdrs.slots;
+		hdrs.used -= hdrs.drop;
+		hdrs.drop = 0;
+		MsgLog_dropTo(&Storage, storeOldest());
+	}
+	while (hdrs.slots - hdrs.used < hdrNeed() || !MsgLog_fits(&Storage, size)){
+		old = &hdrs.slot[hdrs.head];
+		if (hdrs.used == 0 || old->data.flags == MSG_PEND){
+			ok = FALSE;
+			break;
+		}
+		if (old->data.flags == MSG_LIVE){
+			msgUnlink(old);
+			evicted++;
+		}
+		if (old->data.text != NULL){	// holes the compactor left haven't any
+			MsgLog_dropTo(&Storage, old->data.text);	// along with any gap or filler in front
+			MsgLog_drop(&Storage);
 		}
+		hdrs.head = (hdrs.head + 1) % hdrs.slots;
+		hdrs.used--;
+	}
+	storeClean();
+	os_mut_release(&mut_cursor);
+	os_mut_release(&mut_msgList);
+	if (evicted != 0){
+		storeEvicted += evicted;
+		os_evt_set(newMsg, idDispTask);	// count changed, maybe what's on screen too
+	}
+	return ok;
+}
+
+/*
+*	storeOldest(), the oldest text still in the log, from the first header
+*	from hdrs.head that has any.
+*	returns it, NULL if nothing stored has
+*/
+uint8_t *storeOldest(void){
+	uint32_t i;
+	for (i = 0; i < hdrs.used; i++){
+		if (hdrs.slot[(hdrs.head + i) % hdrs.slots].data.text != NULL){
+			return hdrs.slot[(hdrs.head + i) % hdrs.slots].data.text;
+		}
+	}
+	return NULL;
+}
+
+/*
+*	msgUnlink(), takes a message out of lstStr, moving the display cursor and
+*	the export along if they were on it, and drops its chunk's search
+*	postings if it was the last one there.  Caller holds mut_msgList and
+*	mut_cursor.
+*	@node* 	is the message
+*/
+void msgUnlink(ListNode *node){
+	if (cursor.msg == node){
+		// try to go one way, and then check the other, and if nothing, NULL.
+		cursor.msg = node->prev ? node->prev : node->next ? node->next : NULL;
+		cursor.row = 0;
+	}
+	if (exportNext == node){	// an export was about to send this one
+		exportNext = node->next;
+	}
+	List_remove(&lstStr, node);
+	PosIndex_clear(&msgIdx, node - hdrs.slot);
+	triTidy((node - hdrs.slot) / TRI_CHUNK);
+}
+
+/*
+*	triTidy(), drops a chunk's search postings if there's nothing left in it
+*	to find.  Caller holds mut_msgList.
+*	@chunk 	is the chunk, TRI_CHUNK header slots
+*/
+void triTidy(uint32_t chunk){
+	uint32_t mask = (0xFFFFFFFFUL >> (32 - TRI_CHUNK)) << (chunk * TRI_CHUNK % 32);	// its slots' bits, all in one word
+	if (msgIdx.bits[chunk * TRI_CHUNK / 32] & mask){
+		return;
+	}
+	Tri_clearChunk(&triIdx, chunk);
+}
+
+/*
+*	triDrop(), drops the search postings for a run of slots just taken off
+*	the position index: the whole chunks in one pass, and the part chunks
+*	at either end if nothing's left in them.  Caller holds mut_msgList.
+*	@from 	is the first slot
+*	@to 		is one past the last, no wrapping
+*/
+void triDrop(uint32_t from, uint32_t to){
+	if (from >= to){
+		return;
+	}
+	Tri_clearRange(&triIdx, (from + TRI_CHUNK - 1) / TRI_CHUNK, to / TRI_CHUNK);
+	if (from % TRI_CHUNK){
+		triTidy(from / TRI_CHUNK);
 	}
+	if (to % TRI_CHUNK){
+		triTidy(to / TRI_CHUNK);
+	}
+}
+
+/*
+*	msgDropBefore(), deletes every message older than keep, or all of them,
+*	without visiting any: one cut out of lstStr, a word at a time off the
+*	position index and the search index, and the store gets the slots back
+*	the next time TextRX needs room.  Caller holds mut_msgList and mut_cursor.
+*	@keep* 	is the oldest message to keep, NULL to delete everything
+*/
+void msgDropBefore(ListNode *keep){
+	List gone;	// the cut off run, nothing more needs doing with it
+	ListNode *last = keep != NULL ? keep->prev : lstStr.last;
+	uint32_t n, from, to;
+	if (last == NULL){	// nothing older
+		return;
+	}
+	n = msgPos(last);	// positions count from the oldest, so that's how many go
+	if (cursor.msg != NULL && msgPos(cursor.msg) <= n){
+		cursor.msg = keep;
+		cursor.row = 0;
+	}
+	if (exportNext != NULL && msgPos(exportNext) <= n){	// an export was about to send these
+		exportNext = keep;
+	}
+	List_cut(&lstStr, lstStr.first, last, n, &gone);
+
+	// every slot from the oldest to keep's (or the newest committed) goes,
+	// deleted ones in between included
+	from = hdrFirst();
+	to = keep != NULL ? keep - hdrs.slot : (timeEnd + 1) % hdrs.slots;
+	if (to > from){
+		PosIndex_clearRange(&msgIdx, from, to);
+		triDrop(from, to);
+	} else {	// wraps round the end of the table
+		PosIndex_clearRange(&msgIdx, from, hdrs.slots);
+		PosIndex_clearRange(&msgIdx, 0, to);
+		triDrop(from, hdrs.slots);
+		triDrop(0, to);
+	}
+	hdrs.drop += keep != NULL ? (to + hdrs.slots - from) % hdrs.slots : (timeEnd + hdrs.slots - from) % hdrs.slots + 1;
+}
+
+/*
+*	msgPos(), where a message is in lstStr, without walking it.  Caller holds
+*	mut_msgList.
+*	@node* 	is the message, must be in lstStr
+*	returns its position, 1 for the oldest
+*/
+uint32_t msgPos(ListNode *node){
+	uint32_t slot = node - hdrs.slot;
+	uint32_t below = PosIndex_rank(&msgIdx, hdrFirst());	// newer messages the table wrapped round to
+	if (slot >= hdrFirst()){
+		return PosIndex_rank(&msgIdx, slot) - below + 1;
+	}
+	return msgIdx.total - below + PosIndex_rank(&msgIdx, slot) + 1;
+}
+
+/*
+*	msgAt(), the message at a position in lstStr, without walking it.  Caller
+*	holds mut_msgList.
+*	@pos 	is the position, counting from 0 this time
+*	returns the message, NULL if there aren't that many
+*/
+ListNode *msgAt(uint32_t pos){
+	uint32_t below = PosIndex_rank(&msgIdx, hdrFirst());
+	uint32_t slot;
+	if (pos >= msgIdx.total){
+		return NULL;
+	}
+	if (pos < msgIdx.total - below){	// between the head and the end of the table
+		slot = PosIndex_select(&msgIdx, below + pos);
+	} else {	// wrapped round to the bottom
+		slot = PosIndex_select(&msgIdx, pos - (msgIdx.total - below));
+	}
+	return &hdrs.slot[slot];
+}
+
+/*
+*	timeMark(), keeps the time for the time index if the node's slot is one
+*	of the sampled ones.
+*	@node* 	is the message
+*	@key 		is its time, seconds since power up
+*/
+void timeMark(ListNode *node, uint32_t key){
+	uint32_t slot = node - hdrs.slot;
+	if (slot % TIME_SAMPLE == 0){
+		timeKey[slot / TIME_SAMPLE] = key;
+	}
+}
+
+/*
+*	timeKeyOf(), a stored message's time in seconds since power up, from
+*	its time of day and the low byte of its day.
+*	@node* 	is the message
+*/
+uint32_t timeKeyOf(ListNode *node){
+	uint32_t day = timeDay - (uint8_t)(timeDay - node->data.day);
+	return day * 86400 + TIME_SECS(&node->data.time);
+}
+
+/*
+*	timeSeek(), finds the first message from a time of day on, the most
+*	recent time it was that time of day.  A binary search over the sampled
+*	slots, then a scan of at most TIME_SAMPLE headers.  Caller holds mut_msgList.
+*	@t* 	is the time of day
+*	returns the message, NULL if there's nothing that late or the store is empty
+*/
+ListNode *timeSeek(Timestamp *t){
+	uint32_t samples = (hdrs.slots + TIME_SAMPLE - 1) / TIME_SAMPLE;
+	uint32_t head = hdrFirst();
+	uint32_t first = (head + TIME_SAMPLE - 1) / TIME_SAMPLE;	// first sampled slot from the head on
+	uint32_t span = (timeEnd + hdrs.slots - head) % hdrs.slots;	// head to newest
+	uint32_t target = timeDay * 86400 + TIME_SECS(t);
+	uint32_t lo = 0, hi = samples, mid, slot;
+	ListNode *node;
+	if (lstStr.count == 0){
+		return NULL;
+	}
+	if (target > timeLast && target >= 86400){	// hasn't got that late today, yesterday then
+		target -= 86400;
+	}
+	// count the sampled slots, in table order, that are stored and earlier than target
+	while (lo < hi){
+		mid = (lo + hi) / 2;
+		slot = (first + mid) % samples * TIME_SAMPLE;
+		if ((slot + hdrs.slots - head) % hdrs.slots <= span && timeKey[slot / TIME_SAMPLE] < target){
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	// everything before the last of those is too early, look from there
+	slot = lo == 0 ? head : (first + lo - 1) % samples * TIME_SAMPLE;
+	for (;;){
+		node = &hdrs.slot[slot];
+		if (node->data.flags == MSG_LIVE && timeKeyOf(node) >= target){
+			return node;
+		}
+		if (slot == timeEnd){
+			return NULL;
+		}
+		slot = (slot + 1) % hdrs.slots;
+	}
+}
+
+/*
+*	commitBatch(), stamps every finished message in the batch and splices the
+*	whole batch onto the storage list under a single lock hold, then wakes
+*	the display once.
+*	@batch* 	is the list of received nodes, left empty afterwards
+*/
+void commitBatch(List *batch){
+	static uint8_t text[160];
+	ListNode *message;
+	uint32_t key;
+	if (batch->count == 0){
+		return;
+	}
+	os_mut_wait(&mut_osTimestamp, 0xffff);
+	os_mut_wait(&mut_msgList, 0xffff);
+	storeDirty();
+
+	key = timeDay * 86400 + TIME_SECS(&osTimestamp);
+	if (key < timeLast){	// clock went round (or got set back), call it a new day
+		timeDay++;
+		key += 86400;
+	}
+	timeLast = key;
+	timeEnd = batch->last - hdrs.slot;
+	for (message = batch->first; message != NULL; message = message->next){
+		message->data.time = osTimestamp;	// time = stamped
+		message->data.day = timeDay;
+		timeMark(message, key);
+		message->data.flags = MSG_LIVE;	// fair game for eviction from here on
+		PosIndex_set(&msgIdx, message - hdrs.slot);
+		msgText(&message->data, 0, message->data.cnt, text);
+		Tri_add(&triIdx, (message - hdrs.slot) / TRI_CHUNK, text, message->data.cnt);
+		message->data.check = msgCheck(&message->data, text);
+		message->data.magic = MSG_MAGIC;
+	}
+	rxStats.msgs += batch->count;
+	rxStats.batches++;
+	List_join(&lstStr, batch);		// put our things as the most recent messages
+	storeClean();
+	os_evt_set(newMsg, idDispTask);
+	os_evt_set(arcKick, idArchiverTask);
+
+	os_mut_release(&mut_osTimestamp);
+	os_mut_release(&mut_msgList);
+}
+
+/*
+*	msgCheck(), Fletcher-16 over a message's header (bar the flags, which
+*	change after it's committed) and its text, so a scan after a reset can
+*	tell real headers from junk.
+*	@data* 	is the message
+*	@text* 	is its text, unpacked
+*/
+uint16_t msgCheck(NodeData *data, uint8_t *text){
+	uint8_t hdr[15];
+	uint32_t a = 0, b = 0;	// no need to reduce as we go, 175 bytes can't overflow them
+	uint32_t ptr = (uint32_t)data->text;
+	uint8_t i;
+	for (i = 0; i < 4; i++){
+		hdr[i] = data->seq >> (i * 8);
+		hdr[i + 4] = ptr >> (i * 8);
+	}
+	hdr[8] = data->cnt;
+	hdr[9] = data->time.hours;
+	hdr[10] = data->time.minutes;
+	hdr[11] = data->time.seconds;
+	hdr[12] = data->day;
+	hdr[13] = data->sig;
+	hdr[14] = data->sig >> 8;
+	for (i = 0; i < sizeof(hdr); i++){
+		a += hdr[i];
+		b += a;
+	}
+	for (i = 0; i < data->cnt; i++){
+		a += text[i];
+		b += a;
+	}
+	return (b % 255) << 8 | a % 255;
+}
+
+/*
+*	msgValid(), whether a header left over from before a reset is a
+*	committed message: the magic, flags, length and text pointer make sense
+*	and the check matches.
+*	@node* 	is the header
+*	@text* 	gets its text, 160 long
+*/
+uint8_t msgValid(ListNode *node, uint8_t *text){
+	NodeData *d = &node->data;
+	if (d->magic != MSG_MAGIC || (d->flags != MSG_LIVE && d->flags != MSG_DEAD) || d->cnt == 0 || d->cnt > 160
+			|| d->text < Storage.base + sizeof(LogRec) || d->text >= Storage.base + Storage.size || (d->text - Storage.base) % 4 != 0){
+		return FALSE;
+	}
+	msgText(d, 0, d->cnt, text);
+	return d->check == msgCheck(d, text);
+}
+
+/*
+*	storeDirty(), marks the saved copy of the store out of date, before
+*	lstStr or the store change.  Caller holds mut_msgList.
+*/
+void storeDirty(void){
+	storeSave->dirty = TRUE;
+}
+
+/*
+*	storeClean(), brings the saved copy of the store back in step after
+*	they've changed.  Caller holds mut_msgList.
+*/
+void storeClean(void){
+	storeSave->size = storeSize;
+	storeSave->slots = hdrs.slots;
+	storeSave->head = hdrs.head;
+	storeSave->used = hdrs.used;
+	storeSave->drop = hdrs.drop;
+	storeSave->list = lstStr;
+	storeSave->day = timeDay;
+	storeSave->last = timeLast;
+	storeSave->end = timeEnd;
+	storeSave->seq = storeSeq;
+	storeSave->check = saveCheck();
+	storeSave->magic = STORE_SAVED;
+	storeSave->dirty = FALSE;
+}
+
+// rotate and xor over the saved copy from size on, random contents won't match it
+uint32_t saveCheck(void){
+	uint32_t *w, sum = 0;
+	for (w = &storeSave->size; w < (uint32_t *)(storeSave + 1); w++){
+		sum = (sum << 1 | sum >> 31) ^ *w;
+	}
+	return sum;
+}
+
+/*
+*	storeRecover(), picks the store back up after a reset that left the
+*	external SRAM alone: straight from the saved copy if it was left clean,
+*	otherwise by checking every header.  Starts it empty if neither works or
+*	the power went.  Called from InitTask before the other tasks exist, so
+*	nothing is locked.
+*	returns how it went, RECOVER_NONE, _FAST or _SCAN
+*/
+uint8_t storeRecover(void){
+	uint32_t reset = RCC->CSR;
+	RCC->CSR |= RCC_CSR_RMVF;	// so the next reset's cause is its own
+
+	// the backup SRAM, kept up by its regulator on the battery
+	RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+	PWR->CR |= PWR_CR_DBP;
+	RCC->AHB1ENR |= RCC_AHB1ENR_BKPSRAMEN;
+	PWR->CSR |= PWR_CSR_BRE;
+	while (!(PWR->CSR & PWR_CSR_BRR));	// not kept up on the battery until it's ready
+
+	if (!(reset & (RCC_CSR_PORRSTF | RCC_CSR_BORRSTF))){	// power was never off, the SRAM kept everything
+		if (storeResume()){
+			return RECOVER_FAST;
+		}
+		if (storeScan()){
+			return RECOVER_SCAN;
+		}
+	}
+	storeWipe();
+	return RECOVER_NONE;
+}
+
+/*
+*	storeResume(), the quick way back: everything about the store is as it
+*	was saved, lstStr's links included, only the indexes in internal RAM
+*	need rebuilding from the headers' flags.
+*	returns FALSE if the saved copy is missing, half written or for some
+*	other layout
+*/
+uint8_t storeResume(void){
+	ListNode *last = NULL;
+	uint32_t i;
+	if (storeSave->magic != STORE_SAVED || storeSave->dirty || storeSave->size != storeSize
+			|| storeSave->slots != hdrs.slots || storeSave->check != saveCheck()){
+		return FALSE;
+	}
+	hdrs.head = storeSave->head;
+	hdrs.used = storeSave->used;
+	hdrs.drop = storeSave->drop;
+	lstStr = storeSave->list;
+	timeDay = storeSave->day;
+	timeLast = storeSave->last;
+	timeEnd = storeSave->end;
+	storeSeq = storeSave->seq;
+	if (hdrs.used != 0){
+		storeSeq = hdrs.slot[(hdrs.head + hdrs.used - 1) % hdrs.slots].data.seq + 1;	// the saved one can be behind a message TextRX was taking
+	}
+	for (i = hdrs.used; i > 0; i--){	// the newest with any text, the compactor's holes have none
+		last = &hdrs.slot[(hdrs.head + i - 1) % hdrs.slots];
+		if (last->data.text != NULL){
+			break;
+		}
+	}
+	if (i != 0){
+		MsgLog_resume(&Storage, storeOldest(), last->data.text);
+	} else {	// nothing but holes, nothing's in the log
+		MsgLog_dropTo(&Storage, NULL);
+	}
+	storeIndex();
+	return TRUE;
+}
+
+// storeScan() marks the slots that check out in the position index's bits,
+// it isn't built yet
+#define scanGood(s) (posBits[(s) / 32] & (1UL << ((s) % 32)))
+
+/*
+*	storeScan(), the slow way back, when the saved copy can't be trusted.
+*	Every header with the magic and a good check is a message; the newest
+*	and the unbroken run of sequence numbers back from it is what was
+*	stored.  Anything in the run that doesn't check out was pending when it
+*	went, or half moved by the compactor, and is taken as deleted, with no
+*	text; its blob goes whenever the next one after it does.  lstStr and
+*	the search index are rebuilt on the way; bulk deletes that hadn't been
+*	handed back yet come back.
+*	returns FALSE if there's nothing there to recover
+*/
+uint8_t storeScan(void){
+	static uint8_t text[160];
+	ListNode *node, *newest = NULL;
+	uint32_t s, k, n, head, end, back, d;
+
+	Tri_clear(&triIdx);
+	for (s = 0; s < hdrs.slots; s++){
+		node = &hdrs.slot[s];
+		if (msgValid(node, text)){
+			posBits[s / 32] |= 1UL << (s % 32);
+			Tri_add(&triIdx, s / TRI_CHUNK, text, node->data.cnt);	// a stray posting does no harm
+			if (newest == NULL || node->data.seq > newest->data.seq){
+				newest = node;
+			}
+		}
+	}
+	if (newest == NULL){
+		return FALSE;
+	}
+
+	// back from the newest while the sequence numbers follow on, and the
+	// blobs go back round the log from the newest's without lapping it
+	s = newest - hdrs.slot;
+	n = 1;
+	end = (newest->data.text - Storage.base + ((LogRec *)newest->data.text - 1)->size) % Storage.size;
+	back = 0;
+	for (k = 1; k < hdrs.slots; k++){
+		node = &hdrs.slot[(s + hdrs.slots - k) % hdrs.slots];
+		if (scanGood(node - hdrs.slot)){
+			if (node->data.seq != newest->data.seq - k){
+				break;	// from a lap of the table before
+			}
+			d = (end + Storage.size - (node->data.text - Storage.base)) % Storage.size;
+			if (d <= back){
+				break;	// from a lap of the log before, evicted but not written over yet
+			}
+			back = d;
+			n = k + 1;
+		}
+	}
+	head = (s + hdrs.slots + 1 - n) % hdrs.slots;
+
+	// the holes get their place in the run back, the archiver goes by it
+	for (k = 0; k < n; k++){
+		node = &hdrs.slot[(head + k) % hdrs.slots];
+		if (!scanGood((head + k) % hdrs.slots)){
+			node->data.text = NULL;
+			node->data.seq = newest->data.seq - (n - 1 - k);
+			node->data.flags = MSG_DEAD;
+		}
+	}
+
+	hdrs.head = head;
+	hdrs.used = n;
+	hdrs.drop = 0;
+	MsgLog_resume(&Storage, hdrs.slot[head].data.text, newest->data.text);
+	for (k = 0; k < n; k++){
+		node = &hdrs.slot[(head + k) % hdrs.slots];
+		if (node->data.flags == MSG_LIVE){
+			List_push(&lstStr, node);
+		}
+	}
+	timeDay = newest->data.day;	// only the low byte's kept, but the days only have to line up with each other
+	timeLast = timeKeyOf(newest);
+	timeEnd = s;
+	storeSeq = newest->data.seq + 1;
+	storeIndex();
+	return TRUE;
+}
+
+/*
+*	storeIndex(), rebuilds the position and time indexes (internal RAM, so
+*	gone after a reset) from the headers in use, and drops anything that was
+*	still pending.
+*/
+void storeIndex(void){
+	ListNode *node;
+	uint32_t i, key = 0;
+	PosIndex_init(&msgIdx, posBits, posTree, hdrs.slots);
+	for (i = 0; i < hdrs.used; i++){
+		node = &hdrs.slot[(hdrs.head + i) % hdrs.slots];
+		if (node->data.flags == MSG_LIVE){
+			if (i >= hdrs.drop){	// bulk deleted ones are still flagged live
+				PosIndex_set(&msgIdx, node - hdrs.slot);
+			}
+			if (timeKeyOf(node) > key){
+				key = timeKeyOf(node);
+			}
+		} else {
+			node->data.flags = MSG_DEAD;	// never made it into lstStr
+		}
+		timeMark(node, key);
+	}
+}
+
+/*
+*	storeWipe(), starts the store empty, with the magic cleared out of every
+*	header so nothing from before can pass for a message after the next reset.
+*/
+void storeWipe(void){
+	uint32_t s;
+	for (s = 0; s < hdrs.slots; s++){
+		hdrs.slot[s].data.magic = 0;
+	}
+	Tri_clear(&triIdx);
+	PosIndex_init(&msgIdx, posBits, posTree, hdrs.slots);
+	lstStr.count = 0;
+	lstStr.first = NULL;
+	lstStr.last = NULL;
+	storeSeq = 0;
+}
+
+/*
+*	recoverReport(), sends how the store came back at power up as CSV.
+*/
+void recoverReport(void){
+	static const char *how[] = {"none", "fast", "scan"};
+	static uint8_t line[32];
+	uint8_t len;
+	SER_WriteWait((uint8_t *)"recover,msgs,cycles\r\n", 21, 0xffff);
+	memcpy(line, how[recoverStats.how], 4);	// all four letters
+	len = 4;
+	line[len++] = ',';
+	len += benchNum(line + len, recoverStats.msgs);
+	line[len++] = ',';
+	len += benchNum(line + len, recoverStats.cycles);
+	line[len++] = '\r';
+	line[len++] = '\n';
+	SER_WriteWait(line, len, 0xffff);
+}
+
+/*
+*	msgSig(), one bit per bucket of letters/digits that show up in the text,
+*	case folded.  A search can pass over any message whose header doesn't
+*	have all the bits its search term has, without reading the text.
+*	@text* 	is the message text
+*	@cnt 		is how long it is
+*/
+uint16_t msgSig(uint8_t *text, uint8_t cnt){
+	uint16_t sig = 0;
+	uint8_t i, c;
+	for (i = 0; i < cnt; i++){
+		c = text[i] | 0x20;	// lower case, digits stay digits
+		if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')){
+			sig |= 1 << (c & 0x0f);
+		}
+	}
+	return sig;
+}
+
+/*
+*	rxParseChar(), key parsing for one received character.
+*	@buf* 	is the message being assembled
+*	@idx* 	is our place in the message
+*	@data 	is the received character
+*	returns TRUE when buf holds a complete message (buf->cnt is set)
+*/
+uint8_t rxParseChar(NodeData *buf, uint8_t *idx, uint8_t data){
+	if (data >= 0x20 && data <= 0x7E){	// exclude the backspace key, include space.
+		buf->text[(*idx)++] = data;
+		if (*idx == 160){	// if we've filled a page
+			buf->cnt = *idx;
+			*idx = 0;
+			return TRUE;
+		}
+	} else if (data == 0x7F){	// backspace character, clamp at zero
+		if (*idx > 0){
+			(*idx)--;
+		}
+	} else if (data == 0x0D && *idx > 0){	// return, ignore empty messages
+		buf->cnt = *idx;
+		*idx = 0;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+
+/*
+*		Export task.  Streams every stored message out of USART3 as CSV,
+*		oldest first:  hh:mm:ss,"text"  with quotes in the text doubled.
+*		The list is only locked long enough to copy out a few messages at a
+*		time, so TextRX and DisplayTask carry on while the (much slower)
+*		serial transfer happens.
+*/
+__task void ExportTask(void){
+	static NodeData chunk[EXPORT_CHUNK];	// copied out of SRAM under the lock
+	static uint8_t chunkText[EXPORT_CHUNK][160];	// their text unpacked, the blob could be gone once unlocked
+	static uint8_t line[EXPORT_LINE];			// one CSV line
+	uint32_t start;
+	uint16_t len;
+	uint8_t n, i;
+	uint16_t flags;
+	for (;;){
+		os_evt_wait_or(exportCmd | benchCmd | searchCmd, 0xffff);
+		flags = os_evt_get();	// every flag that came in is cleared now, so do them all
+		if (flags & benchCmd){
+			benchRun();
+		}
+		if (flags & searchCmd){
+			searchRun();
+		}
+		if (!(flags & exportCmd)){
+			continue;
+		}
+		start = os_time_get();
+		exportStats.msgs = 0;
+		exportStats.bytes = 0;
+
+		os_mut_wait(&mut_msgList, 0xffff);
+		exportNext = lstStr.first;
+		os_mut_release(&mut_msgList);
+
+		SER_WriteWait((uint8_t *)"time,text\r\n", 11, 0xffff);
+		do {
+			os_mut_wait(&mut_msgList, 0xffff);
+			for (n = 0; n < EXPORT_CHUNK && exportNext != NULL; n++){
+				chunk[n] = exportNext->data;
+				chunk[n].text = chunkText[n];
+				msgText(&exportNext->data, 0, exportNext->data.cnt, chunkText[n]);
+				exportNext = exportNext->next;
+			}
+			os_mut_release(&mut_msgList);
+
+			for (i = 0; i < n; i++){	// one line per write keeps the TX ring free for ACKs
+				len = exportLine(line, &chunk[i]);
+				SER_WriteWait(line, len, 0xffff);
+				exportStats.bytes += len;
+			}
+			exportStats.msgs += n;
+		} while (n == EXPORT_CHUNK);
+
+		// wait for the last byte out so the timing covers the whole transfer
+		SER_TxNotify(idExportTask, exportSent);
+		os_evt_wait_or(exportSent, 0xffff);
+		exportStats.ticks = os_time_get() - start;
+	}
+}
+
+/*
+*	benchRun(), times walking the first 1k, 10k and 30k stored messages three
+*	ways and sends the cycle counts back as CSV: following the links only
+*	(counting), checking each header's search signature, and reading every
+*	character of text, which is what a walk or search costs when the text
+*	has to be touched (unpacked, if it's packed).  Sizes with not enough
+*	messages stored are skipped; a full 4 MB store holds about 34k.  The
+*	links walk costs what it did before the header table: the headers are
+*	still in the FSMC SRAM, which has no cache, so it's one bus read per
+*	node either way.  Only the sig walk gains, by not reading the text.  Then the display's line decode and glyph
+*	draw times, and how the recovery, the archive, the receive side and the
+*	compactor have done.  The walks are what compaction is for: on a store full of holes
+*	they should come back to what they were on a fresh one.
+*/
+void benchRun(void){
+	static const uint32_t sizes[] = {1000, 10000, 30000};
+	static uint8_t line[80];
+	uint8_t i, how, len;
+	SER_WriteWait((uint8_t *)"msgs,links,sig,text\r\n", 21, 0xffff);
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+		if (lstStr.count < sizes[i]){	// only a hint, benchWalk() checks again under the lock
+			break;
+		}
+		len = benchNum(line, sizes[i]);
+		for (how = 0; how < 3; how++){
+			line[len++] = ',';
+			len += benchNum(line + len, benchWalk(sizes[i], how));
+		}
+		line[len++] = '\r';
+		line[len++] = '\n';
+		SER_WriteWait(line, len, 0xffff);
+	}
+	// and what drawing a message costs, worst line decode against one glyph,
+	// then the last whole message and how many of its cells weren't there
+	// already, the longest DisplayTask kept the frame locked, and the last
+	// copy of the frame to the LCD
+	SER_WriteWait((uint8_t *)"decode,glyph,print,cells,hold,flush\r\n", 37, 0xffff);
+	os_mut_wait(&mut_LCD, 0xffff);
+	len = benchNum(line, printStats.decode);
+	line[len++] = ',';
+	len += benchNum(line + len, printStats.glyph);
+	line[len++] = ',';
+	len += benchNum(line + len, printStats.print);
+	line[len++] = ',';
+	len += benchNum(line + len, printStats.cells);
+	line[len++] = ',';
+	len += benchNum(line + len, printStats.hold);
+	line[len++] = ',';
+	len += benchNum(line + len, printStats.flush);
+	os_mut_release(&mut_LCD);
+	line[len++] = '\r';
+	line[len++] = '\n';
+	SER_WriteWait(line, len, 0xffff);
+	// and glyphs a second, decoding the font bit by bit against from the cache
+	SER_WriteWait((uint8_t *)"glyphs_bits,glyphs_cached\r\n", 27, 0xffff);
+	len = benchNum(line, benchGlyphs(0));
+	line[len++] = ',';
+	len += benchNum(line + len, benchGlyphs(1));
+	line[len++] = '\r';
+	line[len++] = '\n';
+	SER_WriteWait(line, len, 0xffff);
+	// and how long getting the store back took at power up
+	recoverReport();
+	// and the flash archive: write amplification is flash_bytes/rec_bytes
+	SER_WriteWait((uint8_t *)"archived,missed,rec_bytes,flash_bytes,erases,open\r\n", 51, 0xffff);
+	len = benchNum(line, arcStats.msgs);
+	line[len++] = ',';
+	len += benchNum(line + len, arcStats.missed);
+	line[len++] = ',';
+	len += benchNum(line + len, archive.recBytes);
+	line[len++] = ',';
+	len += benchNum(line + len, archive.flashBytes);
+	line[len++] = ',';
+	len += benchNum(line + len, archive.erases);
+	line[len++] = ',';
+	len += benchNum(line + len, arcStats.open);
+	line[len++] = '\r';
+	line[len++] = '\n';
+	SER_WriteWait(line, len, 0xffff);
+	// and bytes received, and lost to a full ring (rxRing.overflows) or the
+	// DMA lapping TextRX, then ingest in messages/second and the lock round
+	// trips it took
+	SER_WriteWait((uint8_t *)"rx_bytes,rx_lost,rx_rate,rx_peak,rx_msgs,rx_batches\r\n", 53, 0xffff);
+#if RX_MODE == RX_MODE_DMA
+	len = benchNum(line, rxDMAParsed);
+	line[len++] = ',';
+	len += benchNum(line + len, rxDMALost);
+#else
+	len = benchNum(line, rxRing.head);
+	line[len++] = ',';
+	len += benchNum(line + len, rxRing.overflows);
+#endif
+	os_mut_wait(&mut_msgList, 0xffff);	// ClockTask updates these together
+	line[len++] = ',';
+	len += benchNum(line + len, rxStats.rate);
+	line[len++] = ',';
+	len += benchNum(line + len, rxStats.peakRate);
+	line[len++] = ',';
+	len += benchNum(line + len, rxStats.msgs);
+	line[len++] = ',';
+	len += benchNum(line + len, rxStats.batches);
+	os_mut_release(&mut_msgList);
+	line[len++] = '\r';
+	line[len++] = '\n';
+	SER_WriteWait(line, len, 0xffff);
+	// and the compactor, holes being stored slots that aren't in lstStr, and
+	// what the store has had to throw out for room
+	SER_WriteWait((uint8_t *)"moved,moved_bytes,freed,holes,evicted\r\n", 39, 0xffff);
+	len = benchNum(line, cmpStats.moves);
+	line[len++] = ',';
+	len += benchNum(line + len, cmpStats.bytes);
+	line[len++] = ',';
+	len += benchNum(line + len, cmpStats.freed);
+	line[len++] = ',';
+	os_mut_wait(&mut_msgList, 0xffff);
+	len += benchNum(line + len, hdrs.used - hdrs.drop - lstStr.count);
+	os_mut_release(&mut_msgList);
+	line[len++] = ',';
+	len += benchNum(line + len, storeEvicted);	// only TextRX writes it, a word read is fine
+	line[len++] = '\r';
+	line[len++] = '\n';
+	SER_WriteWait(line, len, 0xffff);
+}
+
+/*
+*	benchWalk(), one timed walk from the oldest message, under mut_msgList.
+*	@n 		is how many messages to walk
+*	@how 	is 0 for links only, 1 to test signatures, 2 to read the text too
+*	returns the cycles it took, 0 if there weren't n messages
+*/
+uint32_t benchWalk(uint32_t n, uint8_t how){
+	static uint8_t text[160];
+	volatile uint32_t hits = 0;	// so the reads can't be optimised away
+	uint16_t want = msgSig((uint8_t *)"e", 1);
+	ListNode *node;
+	uint32_t i, start, cycles = 0;
+	uint8_t k;
+	os_mut_wait(&mut_msgList, 0xffff);
+	if (lstStr.count >= n){
+		start = DWT->CYCCNT;
+		node = lstStr.first;
+		for (i = 0; i < n; i++){
+			if (how == 1){
+				hits += (node->data.sig & want) == want;
+			} else if (how == 2){
+				msgText(&node->data, 0, node->data.cnt, text);
+				for (k = 0; k < node->data.cnt; k++){
+					hits += text[k] == 'e';
+				}
+			}
+			node = node->next;
+		}
+		cycles = DWT->CYCCNT - start;
+	}
+	os_mut_release(&mut_msgList);
+	return cycles;
+}
+
+/*
+*	benchGlyphs(), glyphs a second drawing font 1 characters straight onto
+*	the LCD's bottom row, then has FlushTask put the row back from the frame.
+*	mut_LCD keeps anyone drawing into the frame off the glyph cache meanwhile.
+*	@cached 	is 0 to draw them straight from the font, 1 from the glyph cache
+*	returns glyphs a second
+*/
+uint32_t benchGlyphs(uint8_t cached){
+	uint32_t i, start;
+	os_mut_wait(&mut_LCD, 0xffff);
+	os_mut_wait(&mut_panel, 0xffff);
+	GLCD_GlyphCache(cached ? (uint16_t *)mySRAM_BASE : NULL, cached ? GLYPH_CACHE : 0);
+	for (i = 0; cached && i < 96; i++){	// the cache fills as it goes, time it full
+		GLCD_DisplayChar(LCD_ROWS - 1, i % LCD_COLS, 1, ' ' + i);
+	}
+	start = DWT->CYCCNT;
+	for (i = 0; i < BENCH_GLYPHS; i++){
+		GLCD_DisplayChar(LCD_ROWS - 1, i % LCD_COLS, 1, ' ' + i % 96);
+	}
+	start = DWT->CYCCNT - start;
+	GLCD_GlyphCache((uint16_t *)mySRAM_BASE, GLYPH_CACHE);
+	shadow.dirty[LCD_ROWS - 1] = DIRTY_ROW;
+	os_mut_release(&mut_panel);
+	os_mut_release(&mut_LCD);
+	os_evt_set(flushKick, idFlushTask);
+	return SystemCoreClock / (start / BENCH_GLYPHS);
+}
+
+/*
+*	benchNum(), writes a number in decimal, no stdio on a task stack.
+*	@p* 	is where it goes, 10 characters is enough
+*	@v 		is the number
+*	returns how many characters it took
+*/
+uint8_t benchNum(uint8_t *p, uint32_t v){
+	uint8_t len = 0, i, c;
+	do {
+		p[len++] = '0' + v % 10;
+		v /= 10;
+	} while (v != 0);
+	for (i = 0; i < len / 2; i++){	// came out backwards
+		c = p[i];
+		p[i] = p[len - 1 - i];
+		p[len - 1 - i] = c;
+	}
+	return len;
+}
+
+/*
+*	searchRun(), finds every stored message with searchText in it (case
+*	folded), oldest first, up to SEARCH_HITS of them, for the display to step
+*	through.  The trigram index narrows it to a few chunks of headers, then
+*	those are checked under the lock a chunk at a time: deleted slots and
+*	failed signatures are passed over without reading the text.  Sends
+*	back how many it found and the cycles it took as CSV.
+*/
+void searchRun(void){
+	static uint32_t cand[(HDR_MAX / TRI_CHUNK + 31) / 32];
+	static uint8_t want[sizeof(searchText)];
+	static uint8_t text[160];
+	static uint8_t line[24];
+	ListNode *node;
+	uint32_t start, first, n, c, slot;
+	uint16_t sig;
+	uint8_t len, i;
+
+	start = DWT->CYCCNT;
+	os_mut_wait(&mut_msgList, 0xffff);
+	len = searchLen;
+	for (i = 0; i < len; i++){
+		want[i] = searchText[i] >= 'A' && searchText[i] <= 'Z' ? searchText[i] | 0x20 : searchText[i];
+	}
+	Tri_query(&triIdx, want, len, cand);	// too short for a trigram, every chunk is a candidate
+	found.count = 0;
+	found.searches++;	// the display stops stepping through the old hits
+	first = hdrFirst() / TRI_CHUNK;	// chunks in table order from here are oldest first
+	os_mut_release(&mut_msgList);
+
+	sig = msgSig(want, len);
+	for (n = 0; n < triIdx.chunks && found.count < SEARCH_HITS; n++){
+		c = (first + n) % triIdx.chunks;
+		if (!(cand[c / 32] & (1UL << (c % 32)))){
+			continue;
+		}
+		os_mut_wait(&mut_msgList, 0xffff);
+		for (slot = c * TRI_CHUNK; slot < (c + 1) * TRI_CHUNK && found.count < SEARCH_HITS; slot++){
+			node = &hdrs.slot[slot];
+			if (!(msgIdx.bits[slot / 32] & (1UL << (slot % 32))) || (node->data.sig & sig) != sig){
+				continue;	// not in lstStr, or can't have it
+			}
+			msgText(&node->data, 0, node->data.cnt, text);
+			if (textHas(text, node->data.cnt, want, len)){
+				found.slot[found.count] = slot;
+				found.key[found.count] = timeKeyOf(node);
+				found.count++;
+			}
+		}
+		os_mut_release(&mut_msgList);
+	}
+	start = DWT->CYCCNT - start;
+	os_evt_set(dispFind, idDispTask);
+
+	SER_WriteWait((uint8_t *)"hits,cycles\r\n", 13, 0xffff);
+	len = benchNum(line, found.count);	// only ExportTask writes it, no lock needed to read
+	line[len++] = ',';
+	len += benchNum(line + len, start);
+	line[len++] = '\r';
+	line[len++] = '\n';
+	SER_WriteWait(line, len, 0xffff);
+}
+
+/*
+*	textHas(), plain substring search, case folded.
+*	@text* 	is the message text
+*	@cnt 		is how long it is
+*	@want* 	is what to look for, already lower case
+*	@len 		is how long that is
+*	returns TRUE if it's in there
+*/
+uint8_t textHas(uint8_t *text, uint8_t cnt, uint8_t *want, uint8_t len){
+	uint8_t i, k, c;
+	for (i = 0; i + len <= cnt; i++){
+		for (k = 0; k < len; k++){
+			c = text[i + k];
+			if ((c >= 'A' && c <= 'Z' ? c | 0x20 : c) != want[k]){
+				break;
+			}
+		}
+		if (k == len){
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/*
+*	findValid(), whether a search hit is still the message that was found,
+*	not deleted or its slot reused since.  Caller holds mut_msgList.
+*	@i 	is which hit
+*/
+uint8_t findValid(uint32_t i){
+	uint32_t slot = found.slot[i];
+	return (msgIdx.bits[slot / 32] & (1UL << (slot % 32))) && timeKeyOf(&hdrs.slot[slot]) == found.key[i];
+}
+
+/*
+*	exportLine(), formats one message as a CSV line.
+*	@line* 	is where the line goes, EXPORT_LINE long
+*	@data* 	is the message
+*	returns the length of the line
+*/
+uint16_t exportLine(uint8_t *line, NodeData *data){
+	uint16_t len = 9;
+	uint8_t i;
+	timeToString(line, &data->time);
+	line[2] = ':';
+	line[5] = ':';
+	line[8] = ',';
+	line[len++] = '"';
+	for (i = 0; i < data->cnt; i++){
+		if (data->text[i] == '"'){
+			line[len++] = '"';
+		}
+		line[len++] = data->text[i];
+	}
+	line[len++] = '"';
+	line[len++] = '\r';
+	line[len++] = '\n';
+	return len;
+}
+
+
+/*
+*		Archiver task.  Copies every committed message into the flash
+*		archive, a page at a time, in the order the headers were handed out.
+*		Woken by each commit; a part filled page goes to flash once things
+*		have been quiet for ARC_IDLE ticks.  Also plays the archive back as
+*		CSV for CMD_ARCHIVE.
+*/
+__task void ArchiverTask(void){
+	static uint8_t rec[4 + TEXT_BYTES_MAX];
+	uint8_t len;
+	for (;;){
+		if (os_evt_wait_or(arcKick | arcDump, ARC_IDLE) == OS_R_TMO){
+			arcFlush();
+			continue;
+		}
+		if (os_evt_get() & arcDump){
+			arcFlush();	// so it's all in there
+			arcDumpRun();
+		}
+		while ((len = arcTake(rec)) != 0){
+			if (!Arc_append(&archive, rec, len)){	// page is full
+				arcFlush();
+				Arc_append(&archive, rec, len);
+			}
+			arcPaged = arcSeq;
+			arcStats.msgs++;
+		}
+	}
+}
+
+/*
+*	arcTake(), the next committed message the archive hasn't had, as a
+*	record: [cnt][hours][minutes][seconds] then the text, packed if
+*	TEXT_PACKED.  Goes by sequence number so it can tell a header that's
+*	been reused; if eviction got there first it carries on from the oldest
+*	header and counts what it missed.  Deleted messages are passed over.
+*	@rec* 	is where the record goes
+*	returns its length, 0 if there's nothing new yet
+*/
+uint8_t arcTake(uint8_t *rec){
+	static uint8_t text[160];
+	ListNode *node;
+	uint32_t next;
+	uint8_t len = 0;
+	os_mut_wait(&mut_msgList, 0xffff);
+	while (len == 0 && arcSeq != storeSeq){
+		node = &hdrs.slot[arcSlot];
+		if (node->data.seq == arcSeq && (arcSlot + hdrs.slots - hdrs.head) % hdrs.slots < hdrs.used){
+			if (node->data.flags == MSG_PEND){	// wait for it to be committed
+				break;
+			}
+			if (node->data.flags == MSG_LIVE && (msgIdx.bits[arcSlot / 32] & (1UL << (arcSlot % 32)))){
+				rec[0] = node->data.cnt;
+				rec[1] = node->data.time.hours;
+				rec[2] = node->data.time.minutes;
+				rec[3] = node->data.time.seconds;
+				msgText(&node->data, 0, node->data.cnt, text);
+#if TEXT_PACKED
+				len = 4 + Text_packedSize(text, node->data.cnt);
+				Text_pack(rec + 4, text, node->data.cnt);
+#else
+				len = 4 + node->data.cnt;
+				memcpy(rec + 4, text, node->data.cnt);
+#endif
+			}
+			arcSlot = (arcSlot + 1) % hdrs.slots;
+			arcSeq++;
+		} else if (node->data.seq >= arcSeq){	// evicted already
+			next = hdrs.used != 0 ? hdrs.slot[hdrs.head].data.seq : storeSeq;
+			arcStats.missed += next - arcSeq;
+			arcSlot = hdrs.head;
+			arcSeq = next;
+		} else {	// TextRX is still handing it out
+			break;
+		}
+	}
+	os_mut_release(&mut_msgList);
+	return len;
+}
+
+/*
+*	arcFlush(), Arc_flush() holding the sender off first if it's going to
+*	erase a sector.  Nothing can be fetched from flash while it does (a
+*	second or more), so the receive interrupts stall along with everything else.
+*	The XOFF is the archiver's own, so TextRX draining its backlog meanwhile
+*	doesn't lift it.  SysTick stalls too, the seconds it misses go back on the clock.
+*/
+void arcFlush(void){
+	static uint32_t lost;	// cycles the clock's missed, under a second's worth
+	uint32_t took;
+	if (!Arc_erasing(&archive)){
+		Arc_flush(&archive);
+		storeSave->arc = arcPaged;
+		return;
+	}
+	SER_FlowOff(SER_FLOW_ARC);
+	os_dly_wait(2);	// long enough for the XOFF to go out
+	took = DWT->CYCCNT;
+	Arc_flush(&archive);
+	took = DWT->CYCCNT - took;
+	storeSave->arc = arcPaged;
+	SER_FlowOn(SER_FLOW_ARC);
+	if (took > SystemCoreClock / 1000){	// one tick's still pending when it's done, that one isn't lost
+		lost += took - SystemCoreClock / 1000;
+	}
+	if (lost >= SystemCoreClock){
+		clockAdd(lost / SystemCoreClock);
+		lost %= SystemCoreClock;
+	}
+}
+
+/*
+*	clockAdd(), moves the clock on by seconds it missed.
+*	@secs 	is how many
+*/
+void clockAdd(uint32_t secs){
+	os_mut_wait(&mut_osTimestamp, 0xffff);
+	secs += osTimestamp.seconds;
+	osTimestamp.seconds = secs % 60;
+	secs = secs / 60 + osTimestamp.minutes;
+	osTimestamp.minutes = secs % 60;
+	osTimestamp.hours = (secs / 60 + osTimestamp.hours) % 24;
+	os_mut_release(&mut_osTimestamp);
+}
+
+/*
+*	arcDumpRun(), sends everything in the archive as CSV, oldest first, in
+*	the same format as the export.
+*/
+void arcDumpRun(void){
+	static uint8_t text[160];
+	static uint8_t line[EXPORT_LINE];
+	static NodeData msg;
+	static ArcCursor at;
+	const uint8_t *rec;
+	uint8_t len;
+#if TEXT_PACKED
+	TextCursor tc;
+#endif
+	SER_WriteWait((uint8_t *)"time,text\r\n", 11, 0xffff);
+	Arc_first(&archive, &at);
+	while ((rec = Arc_next(&archive, &at, &len)) != NULL){
+		msg.cnt = rec[0];
+		msg.time.hours = rec[1];
+		msg.time.minutes = rec[2];
+		msg.time.seconds = rec[3];
+#if TEXT_PACKED
+		Text_seek(&tc, rec + 4, 0);
+		Text_read(&tc, text, msg.cnt);
+#else
+		memcpy(text, rec + 4, msg.cnt);
+#endif
+		msg.text = text;
+		SER_WriteWait(line, exportLine(line, &msg), 0xffff);
+	}
+}
+
+/*
+*	CompactTask(), squeezes the holes out of the store at the lowest
+*	priority there is, so it only gets time nothing else wants.  A pass runs
+*	at power up, for whatever came back, and after anything's deleted if
+*	that's made the store sparse enough; each step of it is one move, so
+*	the locks are only ever held briefly.
+*/
+__task void CompactTask(void){
+	for (;;){
+		while (cmpStep());
+		os_evt_wait_or(cmpKick, 0xffff);
+	}
+}
+
+/*
+*	FlushTask(), copies what's been drawn into the frame to the LCD.  It's
+*	below the tasks that draw, so it goes once they've finished, and the
+*	first pass puts up the whole of the frame InitTask cleared.
+*/
+__task void FlushTask(void){
+	for (;;){
+		flushRun();
+		os_evt_wait_or(flushKick, 0xffff);
+	}
+}
+
+/*
+*	cmpStep(), one step of a compaction pass: looks down from where the last
+*	one stopped, at most CMP_SCAN slots, for the next message to move and
+*	moves it.  When there's nothing left below, the holes above go back to
+*	the store.  A pass starts from arcSlot down, if there are enough holes
+*	(CMP_SPARSE); if eviction or a bulk delete gets past where it's up to,
+*	it starts again.
+*	returns FALSE when the pass is done
+*/
+uint8_t cmpStep(void){
+	uint32_t first, span, holes, k, used, tail;
+	ListNode *node;
+	uint8_t more = TRUE;
+	os_mut_wait(&mut_msgList, 0xffff);
+	os_mut_wait(&mut_cursor, 0xffff);
+	tsk_lock();	// storeAlloc() doesn't take mut_msgList, the headers and the log have to agree
+	used = hdrs.used - hdrs.drop;
+	tail = Storage.tail;
+	tsk_unlock();
+	first = hdrFirst();
+	span = (arcSlot + hdrs.slots - first) % hdrs.slots;	// stored slots the archiver's had
+	if (span > used){	// it's behind eviction, none
+		span = 0;
+	}
+	if (cmp.on && !((cmp.scan + hdrs.slots - first) % hdrs.slots <= (cmp.dst + 1 + hdrs.slots - first) % hdrs.slots
+			&& (cmp.dst + 1 + hdrs.slots - first) % hdrs.slots <= span)){
+		cmp.on = FALSE;	// got evicted from under it
+	}
+	if (!cmp.on){
+		node = &hdrs.slot[arcSlot];
+		if (span == 0 || (span < used && node->data.text == NULL)
+				|| (used - lstStr.count) * CMP_SPARSE <= used){	// pending ones count, near enough
+			more = FALSE;
+		} else {
+			cmp.on = TRUE;
+			cmp.scan = arcSlot;
+			cmp.dst = (arcSlot + hdrs.slots - 1) % hdrs.slots;
+			cmp.end = span < used ? node->data.text - sizeof(LogRec) - Storage.base : tail;
+		}
+	}
+	for (k = 0; more && k < CMP_SCAN; k++){
+		if (cmp.scan == first){	// nothing left to move, the holes go back
+			holes = (cmp.dst + 1 + hdrs.slots - first) % hdrs.slots;
+			storeDirty();
+			hdrs.drop += holes;
+			storeClean();
+			cmpStats.freed += holes;
+			cmp.on = FALSE;
+			more = FALSE;
+			break;
+		}
+		cmp.scan = (cmp.scan + hdrs.slots - 1) % hdrs.slots;
+		node = &hdrs.slot[cmp.scan];
+		if (node->data.flags == MSG_LIVE){
+			if (cmpMove(cmp.scan)){
+				break;
+			}
+			continue;	// it was in place already
+		}
+		node->data.text = NULL;	// a hole, its blob goes whenever the next one does
+	}
+	os_mut_release(&mut_cursor);
+	os_mut_release(&mut_msgList);
+	return more;
+}
+
+/*
+*	cmpMove(), moves a message up into cmp.dst, with its text ending at
+*	cmp.end, unless it's there already.  Its links, the position, time and
+*	search indexes, the cursor, the export and the search hits all follow
+*	it.  Copied first and the old header killed last, so a reset partway
+*	through loses or doubles at most this message.  Caller holds mut_msgList
+*	and mut_cursor.
+*	@src 	is its slot, every slot from there up to cmp.dst is a hole
+*	returns FALSE if it was in place, nothing moved
+*/
+uint8_t cmpMove(uint32_t src){
+	static uint8_t text[160];
+	ListNode *from = &hdrs.slot[src], *to = &hdrs.slot[cmp.dst];
+	LogRec *rec = (LogRec *)from->data.text - 1;
+	uint32_t off = (uint8_t *)rec - Storage.base, size = rec->size;
+	uint32_t dest, seq, key, n, d, i;
+
+	if (from == to && (off + size) % Storage.size == cmp.end){	// nothing to close up
+		cmp.end = off;
+		cmp.dst = (cmp.dst + hdrs.slots - 1) % hdrs.slots;
+		return FALSE;
+	}
+	if (off < cmp.end){
+		dest = cmp.end - size;
+	} else if (cmp.end >= size){	// the gap goes round the end of the log
+		dest = cmp.end - size;
+	} else {	// and it won't fit under cmp.end, so it goes right at the end
+		dest = Storage.size - size;
+	}
+	storeDirty();
+	memmove(Storage.base + dest, rec, size);	// can overlap itself
+	if (from != to){
+		seq = to->data.seq;	// the slot keeps its own, the archiver's been past it
+		to->data = from->data;
+		to->data.seq = seq;
+	}
+	to->data.text = Storage.base + dest + sizeof(LogRec);
+	msgText(&to->data, 0, to->data.cnt, text);
+	to->data.check = msgCheck(&to->data, text);
+	cmpStats.moves++;
+	cmpStats.bytes += size;
+	if (from != to){
+		to->prev = from->prev;
+		to->next = from->next;
+		if (to->prev != NULL){
+			to->prev->next = to;
+		} else {
+			lstStr.first = to;
+		}
+		if (to->next != NULL){
+			to->next->prev = to;
+		} else {
+			lstStr.last = to;
+		}
+		from->data.flags = MSG_DEAD;
+		from->data.text = NULL;
+
+		if (cursor.msg == from){
+			cursor.msg = to;
+		}
+		if (exportNext == from){
+			exportNext = to;
+		}
+		for (i = 0; i < found.count; i++){
+			if (found.slot[i] == src){
+				found.slot[i] = cmp.dst;
+			}
+		}
+		PosIndex_clear(&msgIdx, src);
+		PosIndex_set(&msgIdx, cmp.dst);
+		Tri_add(&triIdx, cmp.dst / TRI_CHUNK, text, to->data.cnt);
+		triTidy(src / TRI_CHUNK);
+		// the sampled times of the holes it leaves behind have to stay in order
+		key = timeKeyOf(to);
+		n = (cmp.dst + hdrs.slots - src) % hdrs.slots;
+		for (d = TIME_SAMPLE - src % TIME_SAMPLE; d <= n; d += TIME_SAMPLE){
+			timeMark(&hdrs.slot[(src + d) % hdrs.slots], key);
+		}
+	}
+	storeClean();
+	cmp.end = dest;
+	cmp.dst = (cmp.dst + hdrs.slots - 1) % hdrs.slots;
+	return TRUE;
+}
+
+
+/*
+*		Serial Initialization and ISR
+*/
+
+void SerialInit(void){
+	SER_Init();
+	CRC_Init();	// frames are checked by the hardware CRC unit
+	NVIC->ISER[USART3_IRQn / 32] = (uint32_t)1 << (USART3_IRQn % 32); // enable USART3 IRQ
+	NVIC->IP[USART3_IRQn] = 0xE0; // set priority for USART3 to 0xE0
+#if RX_MODE == RX_MODE_DMA
+	NVIC->ISER[DMA1_Stream1_IRQn / 32] = (uint32_t)1 << (DMA1_Stream1_IRQn % 32); // enable USART3 RX DMA IRQ
+	NVIC->IP[DMA1_Stream1_IRQn] = 0xE0;
+	SER_InitRxDMA(rxDMABuf, RX_DMA_SIZE);	// DMA fills rxDMABuf, interrupt on idle line
+#else
+	Ring_init(&rxRing, rxRingBuf, RX_RING_SIZE);
+	USART3->CR1 |= USART_CR1_RXNEIE; // enable device interrupt for data received and ready to read
+#endif
+}
+
+
+#if RX_MODE == RX_MODE_DMA
+/*
+*		Ingress point for data in DMA mode.  The DMA has already moved the
+*		characters, so all that's left is to tell TextRX a burst has ended.
+*		Idle flag is cleared by reading SR and then DR.
+*/
+void USART3_IRQHandler(void){
+	SER_TxIRQ();	// transmit side is shared by both receive modes
+	if (USART3->SR & USART_SR_IDLE){
+		(void)USART3->DR;
+		if ((SER_RxDMAIndex(RX_DMA_SIZE) - rxDMARead) % RX_DMA_SIZE >= RX_HIGH_WATER){
+			SER_FlowOff(SER_FLOW_RX);	// TextRX is behind, stop the sender before the DMA laps it
+		}
+		isr_evt_set(txtRx, idTextRX);
+	}
+}
+
+/*
+*		Half and full buffer interrupts, so a burst longer than the DMA
+*		buffer gets parsed before the DMA laps it.  They also keep count of
+*		what it's written, so TextRX can tell if it was lapped anyway.
+*/
+void DMA1_Stream1_IRQHandler(void){
+	uint32_t isr = DMA1->LISR;
+	if (isr & (DMA_LISR_HTIF1 | DMA_LISR_TCIF1)){
+		DMA1->LIFCR = DMA_LIFCR_CHTIF1 | DMA_LIFCR_CTCIF1;
+		rxDMAWritten += (isr & DMA_LISR_HTIF1 ? RX_DMA_SIZE / 2 : 0) + (isr & DMA_LISR_TCIF1 ? RX_DMA_SIZE / 2 : 0);
+		if ((SER_RxDMAIndex(RX_DMA_SIZE) - rxDMARead) % RX_DMA_SIZE >= RX_HIGH_WATER){
+			SER_FlowOff(SER_FLOW_RX);
+		}
+		isr_evt_set(txtRx, idTextRX);
+	}
+}
+
+#else
+/*
+*		Ingress point for data.  Just hands the raw byte to TextRX through the
+*		ring; a full ring (or a hardware overrun) is counted, never blocked on.
+*		Reading DR clears both RXNE and ORE.
+*/
+void USART3_IRQHandler(void){
+	uint16_t sr = USART3->SR;
+	SER_TxIRQ();
+	if (sr & (USART_SR_RXNE | USART_SR_ORE)){
+		if (sr & USART_SR_ORE){	// a character got lost before we could read it
+			rxRing.overflows++;
+		}
+		Ring_put(&rxRing, (uint8_t)USART3->DR);
+		if (Ring_used(&rxRing) >= RX_HIGH_WATER){	// TextRX is behind, stop the sender
+			SER_FlowOff(SER_FLOW_RX);
+		}
+		isr_evt_set(txtRx, idTextRX);
+	}
+}
+#endif
+
+/*
+*		LCD DMA finished (or failed), wakes the task that was drawing.
+*/
+void DMA2_Stream0_IRQHandler(void){
+	GLCD_DmaIRQ();
 }
@@ -0,0 +1,56 @@
+/*------------------------------------------------------------------------------
+ *      Name:    CRC.c
+ *      Purpose: STM32F2xx hardware CRC unit
+ *      Note(s): The unit computes CRC-32 (poly 0x04C11DB7, init 0xFFFFFFFF,
+ *               no reflection, no final xor) one 32-bit word per write, in
+ *               four AHB clock cycles.
+ *----------------------------------------------------------------------------*/
+
+#include <stm32f2xx.h>
+#include "CRC.h"
+
+
+/*------------------------------------------------------------------------------
+ *       CRC_Init:  Enable the CRC unit clock
+ *----------------------------------------------------------------------------*/
+
+void CRC_Init (void) {
+
+  RCC->AHB1ENR |= RCC_AHB1ENR_CRCEN;    /* Enable CRC clock                   */
+  CRC_Reset();
+}
+
+
+/*------------------------------------------------------------------------------
+ *       CRC_Reset:  Start a new CRC at 0xFFFFFFFF
+ *----------------------------------------------------------------------------*/
+
+void CRC_Reset (void) {
+
+  CRC->CR = CRC_CR_RESET;
+}
+
+
+/*------------------------------------------------------------------------------
+ *       CRC_Word:  Feed one word, return the running CRC
+ *----------------------------------------------------------------------------*/
+
+uint32_t CRC_Word (uint32_t word) {
+
+  CRC->DR = word;
+  return (CRC->DR);
+}
+
+
+/*------------------------------------------------------------------------------
+ *       CRC_Value:  Running CRC of everything fed since the last reset
+ *----------------------------------------------------------------------------*/
+
+uint32_t CRC_Value (void) {
+
+  return (CRC->DR);
+}
+
+/*------------------------------------------------------------------------------
+ * End of file
+ *----------------------------------------------------------------------------*/
@@ -0,0 +1,18 @@
+/*-----------------------------------------------------------------------------
+ * Name:    CRC.h
+ * Purpose: STM32F2xx hardware CRC unit definitions
+ *-----------------------------------------------------------------------------
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __CRC_H
+#define __CRC_H
+
+#include <stdint.h>
+
+extern void     CRC_Init  (void);
+extern void     CRC_Reset (void);
+extern uint32_t CRC_Word  (uint32_t word);
+extern uint32_t CRC_Value (void);
+
+#endif /* __CRC_H */
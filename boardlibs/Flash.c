@@ -0,0 +1,89 @@
+/*------------------------------------------------------------------------------
+ *      Name:    Flash.c
+ *      Purpose: STM32F2xx internal flash erase/program, 128 KB sectors only
+ *      Note(s): Programs 32 bits at a time, which needs 2.7 to 3.6 V.  The
+ *               flash is one bank, so while an erase or program is going
+ *               on anything fetched from flash (code, the vector table)
+ *               waits for it; a sector erase takes a second or two.
+ *----------------------------------------------------------------------------*/
+
+#include <stm32f2xx.h>
+#include "Flash.h"
+
+#define FLASH_KEY1      0x45670123
+#define FLASH_KEY2      0xCDEF89AB
+#define FLASH_ERRORS    (FLASH_SR_PGSERR | FLASH_SR_PGPERR | FLASH_SR_PGAERR | \
+                         FLASH_SR_WRPERR | FLASH_SR_OPERR)
+
+
+/*------------------------------------------------------------------------------
+ *       Flash_Sector:  Where a 128 KB sector reads from
+ *----------------------------------------------------------------------------*/
+
+uint32_t *Flash_Sector (uint32_t sector) {
+
+  return (uint32_t *)(0x08020000 + (sector - FLASH_BIG_FIRST) * FLASH_BIG_SIZE);
+}
+
+/*------------------------------------------------------------------------------
+ *       unlock, wait:  Open the control register, wait out the last operation
+ *----------------------------------------------------------------------------*/
+
+static void unlock (void) {
+
+  if (FLASH->CR & FLASH_CR_LOCK) {
+    FLASH->KEYR = FLASH_KEY1;
+    FLASH->KEYR = FLASH_KEY2;
+  }
+  FLASH->SR = FLASH_ERRORS;             /* clear anything left over           */
+}
+
+static uint32_t wait (void) {
+
+  while (FLASH->SR & FLASH_SR_BSY);
+  return FLASH->SR & FLASH_ERRORS;
+}
+
+
+/*------------------------------------------------------------------------------
+ *       Flash_Erase:  Erase a 128 KB sector to all ones
+ *                     returns the error flags, 0 if it went fine
+ *----------------------------------------------------------------------------*/
+
+uint32_t Flash_Erase (uint32_t sector) {
+
+  uint32_t err;
+
+  unlock();
+  wait();
+  FLASH->CR &= ~(FLASH_CR_PSIZE_0 | FLASH_CR_PSIZE_1 | FLASH_CR_SNB);
+  FLASH->CR |=  FLASH_CR_PSIZE_1 | FLASH_CR_SER | (sector * FLASH_CR_SNB_0);
+  FLASH->CR |=  FLASH_CR_STRT;
+  err = wait();
+  FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB);
+  FLASH->CR |=  FLASH_CR_LOCK;
+  return err;
+}
+
+
+/*------------------------------------------------------------------------------
+ *       Flash_Write:  Program words, in order, over erased flash
+ *                     returns the error flags, 0 if it went fine
+ *----------------------------------------------------------------------------*/
+
+uint32_t Flash_Write (uint32_t *dst, const uint32_t *src, uint32_t words) {
+
+  uint32_t err = 0;
+
+  unlock();
+  wait();
+  FLASH->CR &= ~(FLASH_CR_PSIZE_0 | FLASH_CR_PSIZE_1);
+  FLASH->CR |=  FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+  while (words-- && err == 0) {
+    *(volatile uint32_t *)dst++ = *src++;
+    err = wait();
+  }
+  FLASH->CR &= ~FLASH_CR_PG;
+  FLASH->CR |=  FLASH_CR_LOCK;
+  return err;
+}
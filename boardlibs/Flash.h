@@ -0,0 +1,20 @@
+/*-----------------------------------------------------------------------------
+ * Name:    Flash.h
+ * Purpose: STM32F2xx internal flash erase/program definitions
+ *-----------------------------------------------------------------------------
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __FLASH_H
+#define __FLASH_H
+
+#include <stdint.h>
+
+#define FLASH_BIG_SIZE   0x20000        /* sectors 5 to 11 are 128 KB each    */
+#define FLASH_BIG_FIRST  5
+
+extern uint32_t *Flash_Sector (uint32_t sector);
+extern uint32_t  Flash_Erase  (uint32_t sector);
+extern uint32_t  Flash_Write  (uint32_t *dst, const uint32_t *src, uint32_t words);
+
+#endif /* __FLASH_H */
@@ -39,6 +39,12 @@
 #define Yellow          0xFFE0      /* 255, 255, 0   */
 #define White           0xFFFF      /* 255, 255, 255 */
 
+/* Bytes of glyph cache one text/background color pair takes                  */
+#define GLCD_GLYPH_SET  (96*16*24*2)
+
+/* Event a task sleeps on while the DMA draws for it, keep it free            */
+#define GLCD_DMA_FLAG   0x0200
+
 extern void GLCD_Init           (void);
 extern void GLCD_WindowMax      (void);
 extern void GLCD_PutPixel       (unsigned int x, unsigned int y);
@@ -46,13 +52,19 @@ extern void GLCD_SetTextColor   (unsigned short color);
 extern void GLCD_SetBackColor   (unsigned short color);
 extern void GLCD_Clear          (unsigned short color);
 extern void GLCD_DrawChar       (unsigned int x,  unsigned int y, unsigned int cw, unsigned int ch, unsigned char *c);
+extern void GLCD_GlyphCache     (unsigned short *mem, unsigned int size);
 extern void GLCD_DisplayChar    (unsigned int ln, unsigned int col, unsigned char fi, unsigned char  c);
 extern void GLCD_DisplayString  (unsigned int ln, unsigned int col, unsigned char fi, unsigned char *s);
+extern void GLCD_RenderChar     (unsigned short *dst, unsigned int stride, unsigned char fi, unsigned char c);
+extern void GLCD_Blit           (unsigned int x,  unsigned int y, unsigned int w, unsigned int h, const unsigned short *src, unsigned int stride);
 extern void GLCD_ClearLn        (unsigned int ln, unsigned char fi);
 extern void GLCD_Bargraph       (unsigned int x,  unsigned int y, unsigned int w, unsigned int h, unsigned int val);
 extern void GLCD_Bitmap         (unsigned int x,  unsigned int y, unsigned int w, unsigned int h, unsigned char *bitmap);
 extern void GLCD_ScrollVertical (unsigned int dy);
 
+extern void GLCD_InitDMA        (void);
+extern void GLCD_DmaIRQ         (void);
+
 extern void GLCD_WrCmd          (unsigned char cmd);
 extern void GLCD_WrReg          (unsigned char reg, unsigned short val); 
 
@@ -11,6 +11,7 @@
 
 
 #include "stm32f2xx.h"
+#include <rtl.h>
 #include "GLCD.h"
 #include "Font_6x8_h.h"
 #include "Font_16x24_h.h"
@@ -56,6 +57,13 @@
 #define BG_COLOR  0                     /* Background color                   */
 #define TXT_COLOR 1                     /* Text color                         */
 
+/*------------------------- DMA to LCD definitions ---------------------------*/
+
+/* DMA2 Stream0 copies memory to LCD_DAT16 (DMA1 can't do memory to memory).
+   Runs shorter than DMA_MIN pixels go quicker by CPU than setting it up.     */
+#define DMA_MIN    128                  /* Pixels                             */
+#define DMA_MAX    65535                /* Most pixels (NDTR) per transfer    */
+
  
 /*---------------------------- Global variables ------------------------------*/
 
@@ -63,6 +71,27 @@
 static volatile unsigned short Color[2] = {White, Black};
 static unsigned char Himax;
 
+/*------------------------------ Glyph cache ---------------------------------*/
+
+/* 16x24 glyphs kept expanded to RGB565 pixels, so drawing one is a straight
+   copy to the LCD. A set holds every glyph for one text/background color
+   pair and is filled a glyph at a time as they get drawn.                    */
+#define GC_GLYPHS   96                  /* Font_16x24_h, 0x20..0x7F           */
+#define GC_PIXELS   (16*24)             /* Pixels per glyph                   */
+#define GC_SETS     4                   /* Most color pairs held at once      */
+
+static struct {
+  unsigned short *pix;                  /* GC_GLYPHS*GC_PIXELS of them        */
+  unsigned short  fg, bg;               /* Color pair they are drawn in       */
+  unsigned int    valid[(GC_GLYPHS+31)/32];
+} GlyphSet[GC_SETS];
+static unsigned int GlyphSets;          /* Sets the cache memory holds        */
+static unsigned int GlyphNext;          /* Set to give a new pair, in turn    */
+
+static unsigned char           DmaUp;   /* GLCD_InitDMA has run               */
+static volatile OS_TID         DmaTask; /* Task waiting for the transfer      */
+static unsigned short          DmaFill; /* The one pixel a fill repeats       */
+
 /************************ Local auxiliary functions ***************************/
 
 /*******************************************************************************
@@ -137,6 +166,81 @@ static __inline void wr_dat_only (unsigned short dat) {
 }
 
 
+/*******************************************************************************
+* Have the DMA write pixels to the LCD, the calling task sleeps till it's done *
+*   Parameter:    src:    first pixel, or the only one for a fill              *
+*                 n:      number of pixels, at most DMA_MAX                    *
+*                 inc:    DMA_SxCR_PINC to step through src, 0 to fill         *
+*   Return:                                                                    *
+*******************************************************************************/
+
+static void dma_wr (const unsigned short *src, unsigned int n, unsigned int inc) {
+
+  os_evt_clr(GLCD_DMA_FLAG, os_tsk_self());
+  DmaTask = os_tsk_self();
+  DMA2->LIFCR        = DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0 |
+                       DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0;
+  DMA2_Stream0->PAR  = (unsigned int)src;
+  DMA2_Stream0->M0AR = LCD_BASE+2;      /* LCD_DAT16, never incremented       */
+  DMA2_Stream0->NDTR = n;
+  DMA2_Stream0->CR   = DMA_SxCR_DIR_1   | /* Memory to memory                 */
+                       DMA_SxCR_PSIZE_0 | /* Half word to half word           */
+                       DMA_SxCR_MSIZE_0 |
+                       inc              |
+                       DMA_SxCR_TCIE    | /* Done or failed, wake the task    */
+                       DMA_SxCR_TEIE    |
+                       DMA_SxCR_EN;
+  os_evt_wait_or(GLCD_DMA_FLAG, 0xffff);
+}
+
+
+/*******************************************************************************
+* Write one color n times to the LCD                                           *
+*   Parameter:    color:  pixel color                                          *
+*                 n:      number of pixels                                     *
+*   Return:                                                                    *
+*******************************************************************************/
+
+static void wr_fill (unsigned short color, unsigned int n) {
+  unsigned int k;
+
+  if (DmaUp && n >= DMA_MIN) {
+    DmaFill = color;
+    for (; n; n -= k) {
+      k = n > DMA_MAX ? DMA_MAX : n;
+      dma_wr(&DmaFill, k, 0);
+    }
+  }
+  else {
+    while (n--)
+      wr_dat_only(color);
+  }
+}
+
+
+/*******************************************************************************
+* Write n pixels from memory to the LCD                                        *
+*   Parameter:    p:      first pixel                                          *
+*                 n:      number of pixels                                     *
+*   Return:                                                                    *
+*******************************************************************************/
+
+static void wr_copy (const unsigned short *p, unsigned int n) {
+  unsigned int k;
+
+  if (DmaUp && n >= DMA_MIN) {
+    for (; n; n -= k, p += k) {
+      k = n > DMA_MAX ? DMA_MAX : n;
+      dma_wr(p, k, DMA_SxCR_PINC);
+    }
+  }
+  else {
+    while (n--)
+      wr_dat_only(*p++);
+  }
+}
+
+
 /*******************************************************************************
 * Read data from the LCD controller                                            *
 *   Parameter:                                                                 *
@@ -673,14 +777,12 @@ void GLCD_SetBackColor (unsigned short color) {
 *******************************************************************************/
 
 void GLCD_Clear (unsigned short color) {
-  unsigned int i;
 
   GLCD_WindowMax();
   wr_cmd(0x22);
   wr_dat_start();
 
-  for(i = 0; i < (WIDTH*HEIGHT); i++)
-    wr_dat_only(color);
+  wr_fill(color, WIDTH*HEIGHT);
   wr_dat_stop();
 }
 
@@ -729,6 +831,93 @@ void GLCD_DrawChar (unsigned int x, unsigned int y, unsigned int cw, unsigned in
 }
 
 
+/*******************************************************************************
+* Give the 16x24 font a glyph cache, GLCD_GLYPH_SET bytes per color pair      *
+*   Parameter:      mem:      cache memory, NULL for none                      *
+*                   size:     its size in bytes                                *
+*   Return:                                                                    *
+*******************************************************************************/
+
+void GLCD_GlyphCache (unsigned short *mem, unsigned int size) {
+  unsigned int i, j;
+
+  GlyphSets = size / GLCD_GLYPH_SET;
+  if (GlyphSets > GC_SETS)
+    GlyphSets = GC_SETS;
+  GlyphNext = 0;
+  for (i = 0; i < GlyphSets; i++) {
+    GlyphSet[i].pix = mem + i * GC_GLYPHS * GC_PIXELS;
+    GlyphSet[i].fg  = GlyphSet[i].bg = 0;
+    for (j = 0; j < (GC_GLYPHS+31)/32; j++)
+      GlyphSet[i].valid[j] = 0;
+  }
+}
+
+
+/*******************************************************************************
+* Get 16x24 glyph from the cache, expanding it first if it is not there       *
+*   Parameter:      c:        glyph index in Font_16x24_h                      *
+*   Return:         its pixels in the current colors, 0 if there is no cache   *
+*******************************************************************************/
+
+static unsigned short *glyph_get (unsigned int c) {
+  unsigned int i, j, s, pixs;
+  unsigned short fg = Color[TXT_COLOR], bg = Color[BG_COLOR];
+  unsigned short *p;
+
+  if (GlyphSets == 0 || c >= GC_GLYPHS)
+    return 0;
+
+  for (s = 0; s < GlyphSets; s++) {
+    if (GlyphSet[s].fg == fg && GlyphSet[s].bg == bg)
+      break;
+  }
+  if (s == GlyphSets) {                 /* New pair, reuse the oldest set     */
+    s = GlyphNext;
+    GlyphNext = (GlyphNext + 1) % GlyphSets;
+    GlyphSet[s].fg = fg;
+    GlyphSet[s].bg = bg;
+    for (j = 0; j < (GC_GLYPHS+31)/32; j++)
+      GlyphSet[s].valid[j] = 0;
+  }
+
+  p = GlyphSet[s].pix + c * GC_PIXELS;
+  if (!(GlyphSet[s].valid[c >> 5] & (1UL << (c & 31)))) {
+    for (j = 0; j < 24; j++) {          /* Same order GLCD_DrawChar writes    */
+      pixs = Font_16x24_h[c * 24 + j];
+      for (i = 0; i < 16; i++)
+        p[j * 16 + i] = (pixs >> i) & 1 ? fg : bg;
+    }
+    GlyphSet[s].valid[c >> 5] |= 1UL << (c & 31);
+  }
+  return p;
+}
+
+
+/*******************************************************************************
+* Draw 16x24 glyph from the cache                                              *
+*   Parameter:      x:        horizontal position                              *
+*                   y:        vertical position                                *
+*                   c:        glyph index in Font_16x24_h                      *
+*   Return:         1 if drawn, 0 if there is no cache                         *
+*******************************************************************************/
+
+static int GLCD_DrawGlyph (unsigned int x, unsigned int y, unsigned int c) {
+  unsigned short *p = glyph_get(c);
+
+  if (p == 0)
+    return 0;
+
+  GLCD_SetWindow(x, y, 16, 24);
+
+  wr_cmd(0x22);
+  wr_dat_start();
+  wr_copy(p, GC_PIXELS);
+  wr_dat_stop();
+  return 1;
+}
+
+
 /*******************************************************************************
 * Disply character on given line                                               *
 *   Parameter:      ln:       line number                                      *
@@ -746,7 +935,8 @@ void GLCD_DisplayChar (unsigned int ln, unsigned int col, unsigned char fi, unsi
       GLCD_DrawChar(col *  6, ln *  8,  6,  8, (unsigned char *)&Font_6x8_h  [c * 8]);
       break;
     case 1:  /* Font 16 x 24 */
-      GLCD_DrawChar(col * 16, ln * 24, 16, 24, (unsigned char *)&Font_16x24_h[c * 24]);
+      if (!GLCD_DrawGlyph(col * 16, ln * 24, c))
+        GLCD_DrawChar(col * 16, ln * 24, 16, 24, (unsigned char *)&Font_16x24_h[c * 24]);
       break;
   }
 }
@@ -762,10 +952,103 @@ void GLCD_DisplayChar (unsigned int ln, unsigned int col, unsigned char fi, unsi
 *******************************************************************************/
 
 void GLCD_DisplayString (unsigned int ln, unsigned int col, unsigned char fi, unsigned char *s) {
+  static unsigned short  span[WIDTH];   /* One scanline across the string     */
+  static unsigned short *glyph[WIDTH/16];
+  unsigned int i, j, k, n, c, cw, ch, pixs;
+  unsigned short *p;
+
+  cw = fi ? 16 : 6;
+  ch = fi ? 24 : 8;
+  for (n = 0; s[n] && (col + n + 1) * cw <= WIDTH; n++) {
+    if (fi)                             /* Cached glyphs, looked up once      */
+      glyph[n] = glyph_get((unsigned char)(s[n] - 32));
+  }
+  if (n == 0)
+    return;
+
+  /* One window for the whole string, filled a scanline at a time             */
+  GLCD_SetWindow(col * cw, ln * ch, n * cw, ch);
+
+  wr_cmd(0x22);
+  wr_dat_start();
+  for (j = 0; j < ch; j++) {
+    p = span;
+    for (k = 0; k < n; k++) {
+      c = (unsigned char)(s[k] - 32);
+      if (fi && glyph[k]) {
+        for (i = 0; i < 16; i++)
+          *p++ = glyph[k][j * 16 + i];
+      }
+      else {
+        pixs = fi ? Font_16x24_h[c * 24 + j] : Font_6x8_h[c * 8 + j];
+        for (i = 0; i < cw; i++)
+          *p++ = Color[(pixs >> i) & 1];
+      }
+    }
+    wr_copy(span, n * cw);
+  }
+  wr_dat_stop();
+}
+
+
+/*******************************************************************************
+* Draw character into memory instead of on the LCD, in the current colors     *
+*   Parameter:      dst:      where its top left pixel goes                    *
+*                   stride:   pixels from one row of dst to the next           *
+*                   fi:       font index (0 = 6x8, 1 = 16x24)                  *
+*                   c:        ascii character                                  *
+*   Return:                                                                    *
+*******************************************************************************/
+
+void GLCD_RenderChar (unsigned short *dst, unsigned int stride, unsigned char fi, unsigned char c) {
+  unsigned int i, j, cw, ch, pixs;
+  unsigned short *g = 0;
+
+  c -= 32;
+  cw = fi ? 16 : 6;
+  ch = fi ? 24 : 8;
+  if (fi)
+    g = glyph_get(c);
+  for (j = 0; j < ch; j++, dst += stride) {
+    if (g) {
+      for (i = 0; i < 16; i++)
+        dst[i] = g[j * 16 + i];
+    }
+    else {
+      pixs = fi ? Font_16x24_h[c * 24 + j] : Font_6x8_h[c * 8 + j];
+      for (i = 0; i < cw; i++)
+        dst[i] = Color[(pixs >> i) & 1];
+    }
+  }
+}
+
+
+/*******************************************************************************
+* Copy a rectangle of pixels from memory to the LCD, top row first             *
+*   Parameter:      x:        horizontal position                              *
+*                   y:        vertical position                                *
+*                   w:        width in pixels                                  *
+*                   h:        height in pixels                                 *
+*                   src:      its top left pixel                               *
+*                   stride:   pixels from one row of src to the next           *
+*   Return:                                                                    *
+*******************************************************************************/
 
-  while (*s) {
-    GLCD_DisplayChar(ln, col++, fi, *s++);
+void GLCD_Blit (unsigned int x, unsigned int y, unsigned int w, unsigned int h, const unsigned short *src, unsigned int stride) {
+  unsigned int j;
+
+  GLCD_SetWindow(x, y, w, h);
+
+  wr_cmd(0x22);
+  wr_dat_start();
+  if (stride == w) {                    /* Rows back to back, one run         */
+    wr_copy(src, w * h);
   }
+  else {
+    for (j = 0; j < h; j++, src += stride)
+      wr_copy(src, w);
+  }
+  wr_dat_stop();
 }
 
 
@@ -807,20 +1090,17 @@ void GLCD_ClearLn (unsigned int ln, unsigned char fi) {
 *******************************************************************************/
 
 void GLCD_Bargraph (unsigned int x, unsigned int y, unsigned int w, unsigned int h, unsigned int val) {
-  int i,j;
+  int i;
 
   val = (val * w) >> 10;                /* Scale value                        */
+  if (val > w)
+    val = w;
   GLCD_SetWindow(x, y, w, h);
   wr_cmd(0x22);
   wr_dat_start();
   for (i = 0; i < h; i++) {
-    for (j = 0; j <= w-1; j++) {
-      if(j >= val) {
-        wr_dat_only(Color[BG_COLOR]);
-      } else {
-        wr_dat_only(Color[TXT_COLOR]);
-      }
-    }
+    wr_fill(Color[TXT_COLOR], val);
+    wr_fill(Color[BG_COLOR], w - val);
   }
   wr_dat_stop();
 }
@@ -839,17 +1119,15 @@ void GLCD_Bargraph (unsigned int x, unsigned int y, unsigned int w, unsigned int
 *******************************************************************************/
 
 void GLCD_Bitmap (unsigned int x, unsigned int y, unsigned int w, unsigned int h, unsigned char *bitmap) {
-  int i, j;
+  int i;
   unsigned short *bitmap_ptr = (unsigned short *)bitmap;
 
   GLCD_SetWindow (x, y, w, h);
 
   wr_cmd(0x22);
   wr_dat_start();
-  for (i = (h-1)*w; i > -1; i -= w) {
-    for (j = 0; j < w; j++) {
-      wr_dat_only (bitmap_ptr[i+j]);
-    }
+  for (i = (h-1)*w; i > -1; i -= w) {   /* Rows are stored bottom up          */
+    wr_copy (&bitmap_ptr[i], w);
   }
   wr_dat_stop();
 }
@@ -883,6 +1161,43 @@ void GLCD_ScrollVertical (unsigned int dy) {
 }
 
 
+/*******************************************************************************
+* Let fills and copies go by DMA from here on, call it from a task. The       *
+* DMA2_Stream0 interrupt has to call GLCD_DmaIRQ, and from then on a task     *
+* drawing sleeps on GLCD_DMA_FLAG while the pixels go out.                     *
+*   Parameter:                                                                 *
+*   Return:                                                                    *
+*******************************************************************************/
+
+void GLCD_InitDMA (void) {
+
+  RCC->AHB1ENR     |=  RCC_AHB1ENR_DMA2EN; /* Enable DMA2 clock              */
+  DMA2_Stream0->CR &= ~DMA_SxCR_EN;       /* Stream must be off to set up     */
+  while (DMA2_Stream0->CR & DMA_SxCR_EN);
+  DMA2_Stream0->FCR =  DMA_SxFCR_DMDIS |  /* Memory to memory needs the FIFO  */
+                       DMA_SxFCR_FTH;
+  DmaUp = 1;
+}
+
+
+/*******************************************************************************
+* DMA2 Stream0 interrupt, wakes the task waiting for its pixels to go out     *
+*   Parameter:                                                                 *
+*   Return:                                                                    *
+*******************************************************************************/
+
+void GLCD_DmaIRQ (void) {
+
+  if (DMA2->LISR & (DMA_LISR_TCIF0 | DMA_LISR_TEIF0)) {
+    DMA2->LIFCR = DMA_LIFCR_CTCIF0 | DMA_LIFCR_CTEIF0;
+    if (DmaTask) {
+      isr_evt_set(GLCD_DMA_FLAG, DmaTask);
+      DmaTask = 0;
+    }
+  }
+}
+
+
 /*******************************************************************************
 * Write a command to the LCD controller                                        *
 *   Parameter:      cmd:      command to write to the LCD                      *
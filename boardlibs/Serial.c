@@ -6,18 +6,42 @@
  *      Note(s): Possible defines to select the used communication interface:
  *               __DBG_ITM   - ITM SWO interface (USART is used by default)
  *                           - UART3 interface  (default)
+ *               Transmit goes through an interrupt driven ring once
+ *               SER_InitTx() has run; before that it's polled.
  *------------------------------------------------------------------------------
  *      This code is part of the RealView Run-Time Library.
  *      Copyright (c) 2004-2012 KEIL - An ARM Company. All rights reserved.
  *----------------------------------------------------------------------------*/
 
 #include <stm32f2xx.h>
+#include <rtl.h>
 #include "Serial.h"
+#include "..\userlibs\RingBuffer.h"
 
 #ifdef __DBG_ITM
 volatile int32_t ITM_RxBuffer;
 #endif
 
+#define SER_PCLK  30000000UL            /* USART3 runs off APB1, 120MHz / 4   */
+
+#define SER_TX_SIZE  1024               /* TX ring size, power of two         */
+#define SER_REPLY_SIZE  8               /* Reply ring size, power of two      */
+
+static volatile uint8_t ser_stopped;    /* SER_FLOW_ bits of who wants XOFF   */
+static volatile uint8_t ser_prio;       /* XON/XOFF to go out ahead of ring   */
+
+static uint8_t    ser_txBuf[SER_TX_SIZE];
+static RingBuffer ser_tx;               /* Tasks put, TXE interrupt gets      */
+static uint8_t    ser_txUp;             /* SER_InitTx has run                 */
+static OS_MUT     ser_txMut;            /* One writing task at a time         */
+static uint8_t    ser_replyBuf[SER_REPLY_SIZE];
+static RingBuffer ser_reply;            /* SER_Reply puts, TXE interrupt gets */
+static volatile OS_TID   ser_waiter;    /* Task blocked for ring space        */
+static volatile OS_TID   ser_doneTask;  /* Task to tell when TX is all out    */
+static volatile uint16_t ser_doneFlag;
+static volatile OS_TID   ser_replyWaiter; /* Task blocked for reply space     */
+static volatile OS_TID   ser_baudTask;  /* Task in SER_SetBaud waiting for TC */
+
 
 /*------------------------------------------------------------------------------
  *       SER_Init:  Initialize Serial Interface
@@ -52,7 +76,9 @@ void SER_Init (void) {
 
 
 /*------------------------------------------------------------------------------
- *       SER_PutChar:  Write a character to the Serial Port
+ *       SER_PutChar:  Write a character to the Serial Port.  Once SER_InitTx
+ *                     has run this takes the writers' mutex, so it's for
+ *                     tasks only, never an ISR.
  *----------------------------------------------------------------------------*/
 
 int32_t SER_PutChar (int32_t ch) {
@@ -62,13 +88,242 @@ int32_t SER_PutChar (int32_t ch) {
   ITM_SendChar (ch & 0xFF);
   for (i = 10000; i; i--);
 #else
-  while (!(USART3->SR & 0x0080));
-  USART3->DR = (ch & 0xFF);
+  uint8_t c = ch & 0xFF;
+  if (ser_txUp) {                       /* Queue behind anything already      */
+    SER_WriteWait(&c, 1, 0xFFFF);       /* waiting, tasks only                */
+  } else {
+    while (!(USART3->SR & 0x0080));
+    USART3->DR = c;
+  }
 #endif
   return (ch);
 }
 
 
+/*------------------------------------------------------------------------------
+ *       ser_kick:  Make sure the TXE interrupt is on.  CR1 is also changed by
+ *                  the ISR, so the read-modify-write can't be interrupted.
+ *----------------------------------------------------------------------------*/
+
+static void ser_kick (void) {
+
+  __disable_irq();
+  USART3->CR1 |= USART_CR1_TXEIE;
+  __enable_irq();
+}
+
+
+/*------------------------------------------------------------------------------
+ *       SER_InitTx:  Switch transmit over to the interrupt driven TX ring.
+ *                    Call from a task once RTX is running.
+ *----------------------------------------------------------------------------*/
+
+void SER_InitTx (void) {
+
+  Ring_init(&ser_tx, ser_txBuf, SER_TX_SIZE);
+  Ring_init(&ser_reply, ser_replyBuf, SER_REPLY_SIZE);
+  os_mut_init(&ser_txMut);
+  ser_waiter   = 0;
+  ser_doneTask = 0;
+  ser_replyWaiter = 0;
+  ser_baudTask = 0;
+  ser_txUp     = 1;
+}
+
+
+/*------------------------------------------------------------------------------
+ *       SER_Write:  Queue as much of buf as fits, never blocks.
+ *                   Returns the number of bytes queued.
+ *----------------------------------------------------------------------------*/
+
+uint32_t SER_Write (const uint8_t *buf, uint32_t len) {
+  uint32_t n = 0;
+
+  if (os_mut_wait(&ser_txMut, 0) == OS_R_TMO) {
+    return (0);                         /* Another task is mid write          */
+  }
+  while (n < len && Ring_free(&ser_tx)) {
+    Ring_put(&ser_tx, buf[n++]);
+  }
+  if (n) ser_kick();
+  os_mut_release(&ser_txMut);
+  return (n);
+}
+
+
+/*------------------------------------------------------------------------------
+ *       SER_WriteWait:  Queue all of buf, sleeping while the ring is full.
+ *                       Gives up after timeout ticks without progress.
+ *                       Returns the number of bytes queued.
+ *----------------------------------------------------------------------------*/
+
+uint32_t SER_WriteWait (const uint8_t *buf, uint32_t len, uint16_t timeout) {
+  uint32_t n = 0;
+
+  if (os_mut_wait(&ser_txMut, timeout) == OS_R_TMO) {
+    return (0);
+  }
+  while (n < len) {
+    while (n < len && Ring_free(&ser_tx)) {
+      Ring_put(&ser_tx, buf[n++]);
+    }
+    ser_kick();
+    if (n < len) {                      /* Full, sleep until it's half empty  */
+      os_evt_clr(SER_TX_FLAG, os_tsk_self());
+      ser_waiter = os_tsk_self();
+      if (Ring_free(&ser_tx) <= SER_TX_SIZE / 2 &&
+          os_evt_wait_or(SER_TX_FLAG, timeout) == OS_R_TMO) {
+        ser_waiter = 0;
+        break;
+      }
+      ser_waiter = 0;
+    }
+  }
+  os_mut_release(&ser_txMut);
+  return (n);
+}
+
+
+/*------------------------------------------------------------------------------
+ *       SER_Reply:  Queue a one byte reply (ACK/NAK) to go out ahead of the
+ *                   TX ring.  Doesn't take the writers' mutex, so a task
+ *                   asleep in SER_WriteWait can't hold it up.  One task only.
+ *                   Sleeps if replies have outrun the line.
+ *----------------------------------------------------------------------------*/
+
+void SER_Reply (uint8_t ch) {
+
+#ifndef __DBG_ITM
+  if (ser_txUp) {
+    while (!Ring_free(&ser_reply)) {    /* ISR sets the flag as it takes one  */
+      os_evt_clr(SER_TX_FLAG, os_tsk_self());
+      ser_replyWaiter = os_tsk_self();
+      if (!Ring_free(&ser_reply)) {
+        ser_kick();
+        os_evt_wait_or(SER_TX_FLAG, 0xffff);
+      }
+      ser_replyWaiter = 0;
+    }
+    Ring_put(&ser_reply, ch);
+    ser_kick();
+    return;
+  }
+#endif
+  SER_PutChar(ch);
+}
+
+
+/*------------------------------------------------------------------------------
+ *       SER_TxNotify:  Set flag on task once everything queued so far has
+ *                      left the shift register.  One shot.
+ *       SER_TxBusy:    Whether anything is still queued or going out.
+ *----------------------------------------------------------------------------*/
+
+void SER_TxNotify (OS_TID task, uint16_t flag) {
+
+  ser_doneFlag = flag;
+  ser_doneTask = task;
+  __disable_irq();
+  USART3->CR1 |= USART_CR1_TXEIE;       /* ISR moves on to TC once it's empty */
+  __enable_irq();
+}
+
+uint32_t SER_TxBusy (void) {
+
+  return (Ring_used(&ser_tx) || Ring_used(&ser_reply) || ser_prio ||
+          !(USART3->SR & USART_SR_TC));
+}
+
+
+/*------------------------------------------------------------------------------
+ *       SER_TxIRQ:  Transmit half of the USART3 interrupt, call it from
+ *                   USART3_IRQHandler.  A pending XON/XOFF goes first,
+ *                   then replies, then the ring.
+ *----------------------------------------------------------------------------*/
+
+void SER_TxIRQ (void) {
+  uint32_t cr1 = USART3->CR1;
+  uint32_t sr  = USART3->SR;
+  uint8_t  ch;
+
+  if ((cr1 & USART_CR1_TXEIE) && (sr & USART_SR_TXE)) {
+    if (ser_prio) {
+      USART3->DR = ser_prio;
+      ser_prio = 0;
+    } else if (ser_txUp && Ring_get(&ser_reply, &ch)) {
+      USART3->DR = ch;
+      if (ser_replyWaiter) {
+        isr_evt_set(SER_TX_FLAG, ser_replyWaiter);
+        ser_replyWaiter = 0;
+      }
+    } else if (ser_txUp && Ring_get(&ser_tx, &ch)) {
+      USART3->DR = ch;
+      if (ser_waiter && Ring_free(&ser_tx) > SER_TX_SIZE / 2) {
+        isr_evt_set(SER_TX_FLAG, ser_waiter);
+        ser_waiter = 0;
+      }
+    } else {                            /* Drained, wait for the last stop bit */
+      USART3->CR1 = (cr1 & ~USART_CR1_TXEIE) |
+                    (ser_doneTask || ser_baudTask ? USART_CR1_TCIE : 0);
+    }
+  } else if ((cr1 & USART_CR1_TCIE) && (sr & USART_SR_TC)) {
+    USART3->CR1 = cr1 & ~USART_CR1_TCIE;
+    if (ser_doneTask) {
+      isr_evt_set(ser_doneFlag, ser_doneTask);
+      ser_doneTask = 0;
+    }
+    if (ser_baudTask) {
+      isr_evt_set(SER_TX_FLAG, ser_baudTask);
+      ser_baudTask = 0;
+    }
+  }
+}
+
+
+/*------------------------------------------------------------------------------
+ *       SER_FlowOff:  Ask the sender to pause (XOFF) on behalf of who, one
+ *                     of the SER_FLOW_ bits.  Safe from an ISR.
+ *       SER_FlowOn:   who doesn't need it paused any more; XON goes once
+ *                     nobody does.
+ *       SER_Stopped:  Whether the sender has been told to pause.
+ *----------------------------------------------------------------------------*/
+
+static void ser_flow (uint8_t who, uint8_t stop) {
+#ifndef __DBG_ITM
+  uint8_t was;
+
+  __disable_irq();                      /* Flag and character have to agree, */
+  was = ser_stopped;                    /* even if the ISR and a task both   */
+  ser_stopped = stop ? was | who : was & ~who;  /* change it at once         */
+  if (!was != !ser_stopped) {
+    if (ser_txUp) {                     /* Jump the TX queue                  */
+      ser_prio = stop ? SER_XOFF : SER_XON;
+      USART3->CR1 |= USART_CR1_TXEIE;
+    } else {
+      while (!(USART3->SR & 0x0080));
+      USART3->DR = stop ? SER_XOFF : SER_XON;
+    }
+  }
+  __enable_irq();
+#endif
+}
+
+void SER_FlowOff (uint8_t who) {
+
+  ser_flow(who, 1);
+}
+
+void SER_FlowOn (uint8_t who) {
+
+  ser_flow(who, 0);
+}
+
+uint32_t SER_Stopped (void) {
+
+  return (ser_stopped != 0);
+}
+
+
 /*------------------------------------------------------------------------------
  *       SER_GetChar:  Read a character from the Serial Port (non-blocking)
  *----------------------------------------------------------------------------*/
@@ -85,6 +340,82 @@ int32_t SER_GetChar (void) {
   return (-1);
 }
 
+/*------------------------------------------------------------------------------
+ *       SER_SetBaud:  Change the USART3 baud rate on the fly.  Sleeps until
+ *                     everything queued has left the shift register first,
+ *                     the TC interrupt wakes it.
+ *----------------------------------------------------------------------------*/
+
+void SER_SetBaud (uint32_t baud) {
+
+#ifndef __DBG_ITM
+  if (!ser_txUp) {                      /* Polled, no interrupt to wait on    */
+    while (!(USART3->SR & USART_SR_TC));
+  }
+  __disable_irq();                      /* Idle check and CR1 change together */
+  while (ser_txUp && SER_TxBusy()) {    /* so the ISR can't slip a byte in    */
+    __enable_irq();
+    os_evt_clr(SER_TX_FLAG, os_tsk_self());
+    ser_baudTask = os_tsk_self();
+    ser_kick();                         /* ISR moves on to TC once it's empty */
+    os_evt_wait_or(SER_TX_FLAG, 0xffff);
+    __disable_irq();
+  }
+  USART3->CR1 &= ~USART_CR1_UE;
+  USART3->BRR  =  (SER_PCLK + baud / 2) / baud; /* 16x oversampling, rounded */
+  USART3->CR1 |=  USART_CR1_UE;
+  __enable_irq();
+#endif
+}
+
+
+/*------------------------------------------------------------------------------
+ *       SER_InitRxDMA:  Let DMA1 Stream1 (channel 4) fill a circular receive
+ *                       buffer from USART3 and interrupt on idle line instead
+ *                       of on every received character.
+ *----------------------------------------------------------------------------*/
+
+void SER_InitRxDMA (uint8_t *buf, uint32_t len) {
+
+#ifndef __DBG_ITM
+  RCC->AHB1ENR       |=  RCC_AHB1ENR_DMA1EN;  /* Enable DMA1 clock            */
+  DMA1_Stream1->CR   &= ~DMA_SxCR_EN;         /* Stream must be off to set up */
+  while (DMA1_Stream1->CR & DMA_SxCR_EN);
+  DMA1->LIFCR         =  DMA_LIFCR_CTCIF1 | DMA_LIFCR_CHTIF1 | DMA_LIFCR_CTEIF1 |
+                         DMA_LIFCR_CDMEIF1 | DMA_LIFCR_CFEIF1;
+  DMA1_Stream1->PAR   =  (uint32_t)&USART3->DR;
+  DMA1_Stream1->M0AR  =  (uint32_t)buf;
+  DMA1_Stream1->NDTR  =  len;
+  DMA1_Stream1->FCR   =  0;                   /* Direct mode, no FIFO         */
+  DMA1_Stream1->CR    =  DMA_SxCR_CHSEL_2 |   /* Channel 4: USART3_RX         */
+                         DMA_SxCR_PL_1    |   /* High priority                */
+                         DMA_SxCR_MINC    |   /* Byte to byte, memory incr.   */
+                         DMA_SxCR_CIRC    |   /* Wrap around at the end       */
+                         DMA_SxCR_HTIE    |   /* Half and full buffer IRQs so */
+                         DMA_SxCR_TCIE;       /* a long burst gets drained    */
+  DMA1_Stream1->CR   |=  DMA_SxCR_EN;
+
+  USART3->CR1        &= ~USART_CR1_RXNEIE;    /* No per character interrupt   */
+  USART3->CR3        |=  USART_CR3_DMAR;
+  USART3->CR1        |=  USART_CR1_IDLEIE;
+#endif
+}
+
+
+/*------------------------------------------------------------------------------
+ *       SER_RxDMAIndex:  Index in the circular buffer the DMA will write next
+ *----------------------------------------------------------------------------*/
+
+uint32_t SER_RxDMAIndex (uint32_t len) {
+
+#ifndef __DBG_ITM
+  uint32_t idx = len - DMA1_Stream1->NDTR;
+  return (idx == len ? 0 : idx);              /* NDTR reloads after 0         */
+#else
+  return (0);
+#endif
+}
+
 /*------------------------------------------------------------------------------
  * End of file
  *----------------------------------------------------------------------------*/
@@ -16,9 +16,35 @@
 #define __SERIAL_H
 
 #include <stdint.h>
+#include <rtl.h>
 
 extern void     SER_Init    (void);
 extern int32_t  SER_GetChar (void);
-extern int32_t  SER_PutChar (int32_t ch);
+extern int32_t  SER_PutChar (int32_t ch);   /* tasks only after SER_InitTx */
+
+#define SER_XON   0x11                  /* software flow control characters   */
+#define SER_XOFF  0x13
+
+#define SER_TX_FLAG 0x0800              /* event a task blocks on in          */
+                                        /* SER_WriteWait, SER_Reply and       */
+                                        /* SER_SetBaud, keep it free          */
+
+extern void     SER_InitTx     (void);
+extern uint32_t SER_Write      (const uint8_t *buf, uint32_t len);
+extern uint32_t SER_WriteWait  (const uint8_t *buf, uint32_t len, uint16_t timeout);
+extern void     SER_Reply      (uint8_t ch);
+extern void     SER_TxNotify   (OS_TID task, uint16_t flag);
+extern uint32_t SER_TxBusy     (void);
+extern void     SER_TxIRQ      (void);
+
+#define SER_FLOW_RX  0x01               /* who wants the sender stopped, it   */
+#define SER_FLOW_ARC 0x02               /* only goes again once nobody does   */
+
+extern void     SER_FlowOff    (uint8_t who);
+extern void     SER_FlowOn     (uint8_t who);
+extern uint32_t SER_Stopped    (void);
+extern void     SER_SetBaud    (uint32_t baud);
+extern void     SER_InitRxDMA  (uint8_t *buf, uint32_t len);
+extern uint32_t SER_RxDMAIndex (uint32_t len);
 
 #endif /* __SERIAL_H */
@@ -110,3 +110,29 @@ void SRAM_Init(void)
 	
 	
 }
+
+/* SRAM_Size: how much SRAM actually answers at mySRAM_BASE, up to max bytes.	*/
+/* Walks up in powers of two until an address aliases back onto the base or		*/
+/* doesn't hold a value.  Everything it touches is put back afterwards.				*/
+unsigned long SRAM_Size(unsigned long max)
+{
+	volatile unsigned short *base = (volatile unsigned short *)mySRAM_BASE;
+	volatile unsigned short *probe;
+	unsigned short saveBase = base[0];
+	unsigned short saveProbe;
+	unsigned long size;
+
+	for (size = 0x1000; size < max; size <<= 1) {
+		probe = (volatile unsigned short *)(mySRAM_BASE + size);
+		saveProbe = *probe;
+		base[0] = 0x5AA5;
+		*probe = 0xA55A;
+		if (*probe != 0xA55A || base[0] != 0x5AA5) {	/* missing, or wrapped onto base	*/
+			*probe = saveProbe;
+			break;
+		}
+		*probe = saveProbe;
+	}
+	base[0] = saveBase;
+	return size < max ? size : max;
+}
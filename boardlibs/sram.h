@@ -4,6 +4,8 @@
 	#define _CY7C1071DV33_LIBRARY
 
 	void SRAM_Init(void);
+	unsigned long SRAM_Size(unsigned long max);
 
 	#define	mySRAM_BASE   (0x60000000UL | 0x08000000UL)
+	#define	mySRAM_SIZE   0x00400000UL		/* 2M x 16, A0-A20 wired up							*/
 #endif
@@ -0,0 +1,253 @@
+/*------------------------------------------------------------------------------
+ *   
+ *------------------------------------------------------------------------------
+ *      Name:    Archive.c
+ *      Purpose: Append-only record log in internal flash
+ *      Note(s): Each sector starts with a header (magic, lap, first record
+ *               number, erase count) written straight after it's erased.
+ *               Records go in blocks of up to ARC_PAGE bytes, one program
+ *               per block.  The length word goes first, then the records,
+ *               then the record numbers and a checksum, so a block cut off
+ *               by a reset either never started (erased length, that's the
+ *               end) or fails its checksum and is stepped over.  Sectors
+ *               are used strictly in turn, so they all wear the same.  Not
+ *               locked, one task owns it.
+ *------------------------------------------------------------------------------
+ *      
+ *----------------------------------------------------------------------------*/
+
+#include <stm32f2xx.h>
+#include <string.h>
+#include "Archive.h"
+#include "..\boardlibs\Flash.h"
+
+#define SEC_HDR 20							// magic, lap, first, erases, check
+#define BLK_HDR 16							// length, first, records, checksum
+#define ERASED 0xFFFFFFFFUL
+
+#define sector(s) ((uint8_t *)Flash_Sector(ARC_FIRST + (s)))
+
+static uint32_t secCheck(const uint32_t *h){
+	return (h[0] ^ (h[1] << 8) ^ (h[2] << 16) ^ (h[3] << 24)) + 1;
+}
+
+// Adler style sum of a block's record numbers and records
+static uint32_t blkSum(const uint32_t *blk, uint32_t len){
+	const uint8_t *p = (const uint8_t *)(blk + 1);
+	uint32_t a = 1, b = 0, i;	// a block is small enough to reduce once at the end
+	for (i = 0; i < 8 + len; i++){
+		a += p[i];
+		b += a;
+	}
+	return (b % 65521) << 16 | a % 65521;
+}
+
+// a block's length from its first word, 0 if that isn't one
+static uint32_t blkLen(uint32_t w){
+	uint32_t len = w & 0xFFFF;
+	if ((w >> 16) != (~len & 0xFFFF) || len % 4 != 0 || len == 0 || len > ARC_PAGE - BLK_HDR){
+		return 0;
+	}
+	return len;
+}
+
+// oldest sector still in the ring
+static uint32_t oldest(Archive *arc){
+	uint32_t s = arc->cur, k;
+	for (k = 1; k < ARC_SECTORS; k++){
+		if (arc->sec[(arc->cur + ARC_SECTORS - k) % ARC_SECTORS].lap != arc->sec[arc->cur].lap - k){
+			break;
+		}
+		s = (arc->cur + ARC_SECTORS - k) % ARC_SECTORS;
+	}
+	return s;
+}
+
+// erase the next sector round and start appending to it
+static void advance(Archive *arc){
+	uint32_t s = (arc->cur + 1) % ARC_SECTORS;
+	uint32_t hdr[SEC_HDR / 4];
+	hdr[0] = ARC_MAGIC;
+	hdr[1] = arc->sec[arc->cur].lap + 1;
+	hdr[2] = arc->next;
+	hdr[3] = arc->sec[s].erases + 1;
+	hdr[4] = secCheck(hdr);
+	arc->sec[s].lap = 0;	// what it had is gone
+	if (Flash_Erase(ARC_FIRST + s) != 0){
+		arc->errors++;
+	}
+	arc->erases++;
+	if (Flash_Write((uint32_t *)sector(s), hdr, SEC_HDR / 4) != 0){
+		arc->errors++;
+	}
+	arc->flashBytes += SEC_HDR;
+	arc->sec[s].lap = hdr[1];
+	arc->sec[s].first = hdr[2];
+	arc->sec[s].erases = hdr[3];
+	arc->cur = s;
+	arc->tail = SEC_HDR;
+}
+
+// read the sector headers for the index, then find where the newest sector
+// ends.  Only that sector's block headers are read.
+void Arc_open(Archive *arc){
+	const uint32_t *h;
+	uint32_t s, k, top = 0, wear = 0, off, len;
+	arc->fill = BLK_HDR;
+	arc->recs = 0;
+	arc->recBytes = 0;
+	arc->flashBytes = 0;
+	arc->erases = 0;
+	arc->errors = 0;
+	arc->cur = ARC_SECTORS - 1;
+	for (s = 0; s < ARC_SECTORS; s++){
+		h = (const uint32_t *)sector(s);
+		if (h[0] == ARC_MAGIC && h[4] == secCheck(h)){
+			arc->sec[s].lap = h[1];
+			arc->sec[s].first = h[2];
+			arc->sec[s].erases = h[3];
+			if (h[3] > wear){
+				wear = h[3];
+			}
+			if (h[1] > top){
+				top = h[1];
+				arc->cur = s;
+			}
+		} else {
+			arc->sec[s].lap = 0;
+			arc->sec[s].erases = 0;
+		}
+	}
+	for (s = 0; s < ARC_SECTORS; s++){
+		if (arc->sec[s].lap == 0){
+			arc->sec[s].erases = wear;	// header lost, say it's worn as much as any
+		}
+	}
+	arc->next = 0;
+	if (top == 0){	// nothing there, the ring starts at the first sector
+		arc->sec[arc->cur].lap = 0;
+		advance(arc);
+		return;
+	}
+	// sectors before the newest that don't follow on in laps are left over, not part of it
+	for (k = 1; k < ARC_SECTORS; k++){
+		s = (arc->cur + ARC_SECTORS - k) % ARC_SECTORS;
+		if (arc->sec[s].lap != top - k){
+			for (; k < ARC_SECTORS; k++){
+				arc->sec[(arc->cur + ARC_SECTORS - k) % ARC_SECTORS].lap = 0;
+			}
+		}
+	}
+
+	arc->next = arc->sec[arc->cur].first;
+	h = (const uint32_t *)sector(arc->cur);
+	for (off = SEC_HDR; off + BLK_HDR <= FLASH_BIG_SIZE; off += BLK_HDR + len){
+		if (h[off / 4] == ERASED){	// the end
+			break;
+		}
+		len = blkLen(h[off / 4]);
+		if (len == 0 || off + BLK_HDR + len > FLASH_BIG_SIZE){	// garbled, nothing more goes in here
+			off = FLASH_BIG_SIZE;
+			break;
+		}
+		if (h[off / 4 + 3] == blkSum(h + off / 4, len)){	// cut off ones just get stepped over
+			arc->next = h[off / 4 + 1] + h[off / 4 + 2];
+		}
+	}
+	arc->tail = off;
+}
+
+// add a record to the block being filled.  FALSE if it's full, flush first.
+uint8_t Arc_append(Archive *arc, const uint8_t *rec, uint8_t len){
+	uint8_t *p = (uint8_t *)arc->page;
+	if (arc->fill + 1 + len > ARC_PAGE){
+		return 0;
+	}
+	p[arc->fill++] = len;
+	memcpy(p + arc->fill, rec, len);
+	arc->fill += len;
+	arc->recs++;
+	arc->recBytes += len;
+	return 1;
+}
+
+// program the block being filled, moving on a sector (erasing it) if it
+// doesn't fit in this one.  A block that won't program is tried once more
+// in the next sector.
+void Arc_flush(Archive *arc){
+	uint8_t *p = (uint8_t *)arc->page;
+	uint32_t *dst, len, tries;
+	if (arc->recs == 0){
+		return;
+	}
+	while (arc->fill % 4 != 0){
+		p[arc->fill++] = 0xFF;
+	}
+	len = arc->fill - BLK_HDR;
+	for (tries = 0; tries < 2; tries++){
+		if (arc->tail + BLK_HDR + len > FLASH_BIG_SIZE){
+			advance(arc);
+		}
+		arc->page[0] = len | (~len << 16);
+		arc->page[1] = arc->next;
+		arc->page[2] = arc->recs;
+		arc->page[3] = blkSum(arc->page, len);
+		dst = (uint32_t *)(sector(arc->cur) + arc->tail);
+		arc->flashBytes += BLK_HDR + len;
+		if (Flash_Write(dst, arc->page, 1) == 0
+				&& Flash_Write(dst + 4, arc->page + 4, len / 4) == 0
+				&& Flash_Write(dst + 1, arc->page + 1, 3) == 0){
+			arc->tail += BLK_HDR + len;
+			arc->next += arc->recs;
+			break;
+		}
+		arc->errors++;
+		arc->tail = FLASH_BIG_SIZE;	// don't trust the rest of this sector
+	}
+	arc->fill = BLK_HDR;
+	arc->recs = 0;
+}
+
+// would flushing now mean erasing a sector
+uint8_t Arc_erasing(Archive *arc){
+	return arc->recs != 0 && arc->tail + ((arc->fill + 3) & ~3UL) > FLASH_BIG_SIZE;
+}
+
+void Arc_first(Archive *arc, ArcCursor *c){
+	c->sec = oldest(arc);
+	c->lap = arc->sec[c->sec].lap;
+	c->off = SEC_HDR;
+	c->left = 0;
+}
+
+// the next good record after c and its length, NULL at the end
+const uint8_t *Arc_next(Archive *arc, ArcCursor *c, uint8_t *len){
+	const uint8_t *base;
+	const uint32_t *w;
+	uint32_t n;
+	for (;;){
+		base = sector(c->sec);
+		if (c->left != 0){
+			c->left--;
+			*len = base[c->at];
+			c->at += 1 + *len;
+			return base + c->at - *len;
+		}
+		w = (const uint32_t *)(base + c->off);
+		n = c->sec == arc->cur && c->off >= arc->tail ? 0 : c->off + BLK_HDR <= FLASH_BIG_SIZE && *w != ERASED ? blkLen(*w) : 0;
+		if (n == 0 || c->off + BLK_HDR + n > FLASH_BIG_SIZE){	// end of this sector's blocks
+			if (c->sec == arc->cur || arc->sec[(c->sec + 1) % ARC_SECTORS].lap != c->lap + 1){
+				return NULL;
+			}
+			c->sec = (c->sec + 1) % ARC_SECTORS;
+			c->lap++;
+			c->off = SEC_HDR;
+			continue;
+		}
+		if (w[3] == blkSum(w, n)){
+			c->at = c->off + BLK_HDR;
+			c->left = w[2];
+		}
+		c->off += BLK_HDR + n;
+	}
+}
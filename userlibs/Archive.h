@@ -0,0 +1,58 @@
+/*-----------------------------------------------------------------------------
+ * Name:    Archive.h
+ * Purpose: Append-only record log in internal flash that survives power
+ *          loss, written a page at a time round a ring of sectors
+ *-----------------------------------------------------------------------------
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __ARCHIVE_H
+#define __ARCHIVE_H
+
+#include <stdint.h>
+
+#define ARC_FIRST 6							// first flash sector of the ring, 128 KB each
+#define ARC_SECTORS 6						// through sector 11, the top 768 KB
+#define ARC_PAGE 512						// most a block (header and records) takes, buffered in RAM until then
+#define ARC_MAGIC 0x31435241		// "ARC1"
+
+// What each sector holds, built at Arc_open() from the sector headers, so
+// finding record n is a look here and a walk of one sector's block headers.
+typedef struct _ArcSector {
+	uint32_t lap;						// how many sectors were started before it, from 1; 0 not in use
+	uint32_t first;					// number of its first record
+	uint32_t erases;				// times it's been erased
+} ArcSector;
+
+typedef struct _Archive {
+	ArcSector sec[ARC_SECTORS];
+	uint32_t cur;						// sector being appended to
+	uint32_t tail;					// offset in it of the next block
+	uint32_t next;					// number the next record flushed gets
+	uint32_t page[ARC_PAGE / 4];	// block being filled
+	uint32_t fill;					// bytes of page used, header included
+	uint32_t recs;					// records in it
+	// write amplification, flashBytes / recBytes
+	uint32_t recBytes;			// record bytes appended
+	uint32_t flashBytes;		// bytes programmed, headers and padding included
+	uint32_t erases;				// sectors erased since Arc_open()
+	uint32_t errors;				// erases or programs that failed
+} Archive;
+
+// place in the archive when reading it back
+typedef struct _ArcCursor {
+	uint32_t lap;						// of the sector it's in
+	uint32_t sec;
+	uint32_t off;						// of the block it's in
+	uint32_t at;						// of the next record
+	uint32_t left;					// records left in the block
+} ArcCursor;
+
+void Arc_open(Archive *arc);
+uint8_t Arc_append(Archive *arc, const uint8_t *rec, uint8_t len);
+void Arc_flush(Archive *arc);
+uint8_t Arc_erasing(Archive *arc);
+void Arc_first(Archive *arc, ArcCursor *c);
+const uint8_t *Arc_next(Archive *arc, ArcCursor *c, uint8_t *len);
+
+#endif /* __ARCHIVE_H */
@@ -0,0 +1,108 @@
+/*------------------------------------------------------------------------------
+ *   
+ *------------------------------------------------------------------------------
+ *      Name:    Frame.c
+ *      Purpose: Receive side of the binary frame protocol (see Frame.h)
+ *      Note(s): Byte at a time state machine, so it runs straight off the
+ *               receive ring/DMA buffer with no frame sized buffer.  The
+ *               payload is checked by the hardware CRC unit as it streams
+ *               past; the caller has to hold on to what it built from the
+ *               payload until FRAME_GOOD or FRAME_BAD comes back.
+ *------------------------------------------------------------------------------
+ *      
+ *----------------------------------------------------------------------------*/
+
+#include <stm32f2xx.h>
+#include "..\boardlibs\CRC.h"
+#include "Frame.h"
+
+// receive states
+#define ST_IDLE		0
+#define ST_TYPE		1
+#define ST_LENLO	2
+#define ST_LENHI	3
+#define ST_DATA		4
+#define ST_CRC		5
+
+// pack a covered byte into the current word, hand full words to the CRC unit
+static void crcByte(FrameRx *frame, uint8_t data){
+	frame->word |= (uint32_t)data << (8 * frame->nword);
+	if (++frame->nword == 4){
+		CRC_Word(frame->word);
+		frame->word = 0;
+		frame->nword = 0;
+	}
+}
+
+void Frame_init(FrameRx *frame){
+	frame->state = ST_IDLE;
+	frame->good = 0;
+	frame->bad = 0;
+}
+
+// give up on a frame in progress, i.e. the sender went quiet half way through
+uint8_t Frame_abort(FrameRx *frame){
+	if (frame->state == ST_IDLE){
+		return FRAME_NOTFRAME;
+	}
+	frame->state = ST_IDLE;
+	frame->bad++;
+	return FRAME_BAD;
+}
+
+uint8_t Frame_rx(FrameRx *frame, uint8_t data){
+	switch (frame->state){
+		case ST_IDLE:
+			if (data != FRAME_STX){
+				return FRAME_NOTFRAME;
+			}
+			CRC_Reset();
+			frame->word = 0;
+			frame->nword = 0;
+			frame->state = ST_TYPE;
+			return FRAME_BUSY;
+		case ST_TYPE:
+			frame->type = data;
+			crcByte(frame, data);
+			frame->state = ST_LENLO;
+			return FRAME_BUSY;
+		case ST_LENLO:
+			frame->len = data;
+			crcByte(frame, data);
+			frame->state = ST_LENHI;
+			return FRAME_BUSY;
+		case ST_LENHI:
+			frame->len |= (uint16_t)data << 8;
+			crcByte(frame, data);
+			if (frame->len > FRAME_MAX_LEN){	// can't be right, resync on the next STX
+				return Frame_abort(frame);
+			}
+			frame->pos = 0;
+			frame->state = frame->len ? ST_DATA : ST_CRC;
+			frame->ncrc = 0;
+			frame->crc = 0;
+			return FRAME_BUSY;
+		case ST_DATA:
+			crcByte(frame, data);
+			if (++frame->pos == frame->len){
+				frame->state = ST_CRC;
+			}
+			return FRAME_PAYLOAD;
+		case ST_CRC:
+			frame->crc |= (uint32_t)data << (8 * frame->ncrc);
+			if (++frame->ncrc < 4){
+				return FRAME_BUSY;
+			}
+			if (frame->nword){	// pad out the last partial word
+				CRC_Word(frame->word);
+			}
+			frame->state = ST_IDLE;
+			if (CRC_Value() == frame->crc){
+				frame->good++;
+				return FRAME_GOOD;
+			}
+			frame->bad++;
+			return FRAME_BAD;
+	}
+	return Frame_abort(frame);
+}
@@ -0,0 +1,52 @@
+/*-----------------------------------------------------------------------------
+ * Name:    Frame.h
+ * Purpose: Length-prefixed, CRC checked binary frames on the serial link
+ *-----------------------------------------------------------------------------
+ *	A frame on the wire is
+ *		STX | type | len lo | len hi | payload[len] | crc (4 bytes, LSB first)
+ *	The CRC is the STM32 hardware CRC-32 (poly 0x04C11DB7, init 0xFFFFFFFF,
+ *	no reflection, no final xor) over type, len and payload packed into
+ *	little endian 32-bit words, the last word padded with zeros.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __FRAME_H
+#define __FRAME_H
+
+#include <stdint.h>
+
+#define FRAME_STX			0x02		// never part of a text message, so it can't be confused
+#define FRAME_ACK			0x06		// sent back for a good frame
+#define FRAME_NAK			0x15		// sent back for a bad one
+#define FRAME_MAX_LEN	8192		// longest payload we'll believe
+
+// frame types
+#define FRAME_MSGS		0x01		// payload is any number of [n][n text bytes] messages
+#define FRAME_CMD			0x10		// payload is [command][arguments]
+
+// what Frame_rx() made of a byte
+#define FRAME_NOTFRAME	0		// not in a frame and not a STX, it belongs to somebody else
+#define FRAME_BUSY			1		// part of the header or CRC, nothing to do
+#define FRAME_PAYLOAD		2		// a payload byte, the caller should use it
+#define FRAME_GOOD			3		// frame finished and the CRC matched
+#define FRAME_BAD				4		// frame finished (or gave up) and has to be thrown out
+
+typedef struct _FrameRx {
+	uint8_t state;		// where in the frame we are
+	uint8_t type;			// type byte from the header
+	uint16_t len;			// payload length from the header
+	uint16_t pos;			// payload bytes seen so far
+	uint32_t word;		// bytes waiting to go to the CRC unit
+	uint8_t nword;		// how many bytes are in word
+	uint8_t ncrc;			// received CRC bytes
+	uint32_t crc;			// received CRC
+	uint32_t good;		// frames accepted
+	uint32_t bad;			// frames rejected
+} FrameRx;
+
+void Frame_init(FrameRx *frame);
+uint8_t Frame_rx(FrameRx *frame, uint8_t data);
+uint8_t Frame_abort(FrameRx *frame);
+
+#define Frame_busy(A) ((A)->state != 0)
+
+#endif /* __FRAME_H */
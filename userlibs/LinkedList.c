@@ -112,3 +112,44 @@ ListNode *List_shift(List *list){
 	ListNode *node = list->first;
 	return node != NULL ? List_remove(list, node) : NULL;
 }
+
+// join moves every node of src onto the tail of list with one relink,
+// no matter how many there are.  src is left empty.
+void List_join(List *list, List *src){
+	if(src->first == NULL){	// nothing to move
+		return;
+	}
+	if(list->last == NULL){
+		list->first = src->first;
+	} else {
+		list->last->next = src->first;
+		src->first->prev = list->last;
+	}
+	list->last = src->last;
+	list->count += src->count;	// count just adds, no walking the nodes
+	src->first = NULL;
+	src->last = NULL;
+	src->count = 0;
+}
+
+// cut takes the run of nodes from first to last (inclusive, first nearer
+// the head) out of list and leaves it in dst, which should be empty.  n is
+// how many nodes the run has; the caller has to know, so nothing gets walked.
+void List_cut(List *list, ListNode *first, ListNode *last, uint32_t n, List *dst){
+	if(first->prev == NULL){
+		list->first = last->next;
+	} else {
+		first->prev->next = last->next;
+	}
+	if(last->next == NULL){
+		list->last = first->prev;
+	} else {
+		last->next->prev = first->prev;
+	}
+	list->count -= n;
+	first->prev = NULL;
+	last->next = NULL;
+	dst->first = first;
+	dst->last = last;
+	dst->count = n;
+}
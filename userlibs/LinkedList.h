@@ -14,9 +14,15 @@
 // definition so that we can reference this struct later (in node construction)
 // struct ListNode;
 typedef struct _NodeData {
-	uint8_t text[160];			// text to be stored
+	uint8_t *text;					// text to be stored, kept apart from the node in its own blob
 	uint8_t cnt;						// how many items are in this message
 	Timestamp time;					// timestamp struct so we minimize data parsing between functions
+	uint16_t sig;						// which character buckets the text has, so searches can skip it unread
+	uint8_t flags;					// MSG_PEND, MSG_LIVE or MSG_DEAD
+	uint8_t day;						// low byte of the day it arrived on, time only goes to 24 hours
+	uint32_t seq;						// allocation order, one up per header, for putting the store back together after a reset
+	uint16_t check;					// msgCheck() of all the above but flags, and the text
+	uint8_t magic;					// MSG_MAGIC once committed
 } NodeData;
 
 typedef struct _ListNode {
@@ -51,6 +57,9 @@ ListNode *List_shift(List *list);
 
 ListNode *List_remove(List *list, ListNode *node);
 
+void List_join(List *list, List *src);
+void List_cut(List *list, ListNode *first, ListNode *last, uint32_t n, List *dst);
+
 #define LIST_FOREACH(List, First, Next, Cur) ListNode *_node = NULL;\
 		ListNode *Cur = NULL;\
     for(Cur = _node = List->First; _node != NULL; Cur = _node = _node->Next)
@@ -0,0 +1,109 @@
+/*------------------------------------------------------------------------------
+ *   
+ *------------------------------------------------------------------------------
+ *      Name:    MsgLog.c
+ *      Purpose: Log-structured circular record store
+ *      Note(s): Appends go at the tail in one contiguous piece; a record that
+ *               won't fit before the end of the region leaves a LOG_WRAP
+ *               filler and starts over at the bottom.  Space only comes back
+ *               by dropping the oldest record, so everything is O(1) and the
+ *               region never fragments.  A record deleted in the middle
+ *               stays put until the head reaches it; the owner keeps track
+ *               of which ones those are.  Not locked, one task appends and
+ *               drops.
+ *------------------------------------------------------------------------------
+ *      
+ *----------------------------------------------------------------------------*/
+
+#include <stm32f2xx.h>
+#include <stddef.h>
+#include "MsgLog.h"
+
+// whole record size for an object of size bytes
+#define recSize(size) ((sizeof(LogRec) + (size) + 3) & ~3UL)
+
+void MsgLog_init(MsgLog *log, void *base, uint32_t size){
+	log->base = (uint8_t *)base;
+	log->size = size & ~3UL;
+	log->head = 0;
+	log->tail = 0;
+	log->used = 0;
+}
+
+// can an object of size bytes go in right now, without dropping anything
+uint8_t MsgLog_fits(MsgLog *log, uint32_t size){
+	uint32_t need = recSize(size);
+	if (log->used == 0){
+		return need <= log->size;
+	}
+	if (log->tail > log->head){	// free space is above the tail and below the head
+		return need <= log->size - log->tail || need <= log->head;
+	}
+	return need <= log->head - log->tail;	// equal means full
+}
+
+void *MsgLog_alloc(MsgLog *log, uint32_t size){
+	uint32_t need = recSize(size);
+	LogRec *rec;
+	if (!MsgLog_fits(log, size)){
+		return NULL;
+	}
+	if (log->used == 0){	// empty, start back at the bottom
+		log->head = 0;
+		log->tail = 0;
+	} else if (log->tail > log->head && need > log->size - log->tail){	// fill to the end and wrap
+		rec = (LogRec *)(log->base + log->tail);
+		rec->size = log->size - log->tail;
+		rec->state = LOG_WRAP;
+		log->used += rec->size;
+		log->tail = 0;
+	}
+	rec = (LogRec *)(log->base + log->tail);
+	rec->size = need;
+	rec->state = LOG_USED;
+	log->used += need;
+	log->tail += need;
+	if (log->tail == log->size){
+		log->tail = 0;
+	}
+	return rec + 1;
+}
+
+// reclaim the oldest record, whatever state it's in
+void MsgLog_drop(MsgLog *log){
+	LogRec *rec = (LogRec *)(log->base + log->head);
+	if (log->used == 0){
+		return;
+	}
+	log->used -= rec->size;
+	log->head += rec->size;
+	if (log->head == log->size){
+		log->head = 0;
+	}
+}
+
+// reclaim everything older than obj's record in one go, or the whole log if
+// obj is NULL.  Nothing is read, it's just the head moving.
+void MsgLog_dropTo(MsgLog *log, void *obj){
+	uint32_t off;
+	if (obj == NULL){
+		log->head = log->tail;
+		log->used = 0;
+		return;
+	}
+	off = (uint8_t *)((LogRec *)obj - 1) - log->base;
+	log->used -= (off + log->size - log->head) % log->size;
+	log->head = off;
+}
+
+// pick a log that's still in memory (after a reset) back up, holding first
+// to last.  Those are objects it handed out, oldest and newest.
+void MsgLog_resume(MsgLog *log, void *first, void *last){
+	LogRec *rec = (LogRec *)last - 1;
+	log->head = (uint8_t *)first - sizeof(LogRec) - log->base;
+	log->tail = ((uint8_t *)rec - log->base + rec->size) % log->size;
+	log->used = (log->tail + log->size - log->head) % log->size;
+	if (log->used == 0){	// head and tail meet with something in it, it's full
+		log->used = log->size;
+	}
+}
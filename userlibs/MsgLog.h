@@ -0,0 +1,42 @@
+/*-----------------------------------------------------------------------------
+ * Name:    MsgLog.h
+ * Purpose: Log-structured circular record store.  Records are appended at
+ *          the tail and only ever reclaimed from the head, oldest first.
+ *-----------------------------------------------------------------------------
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __MSGLOG_H
+#define __MSGLOG_H
+
+#include <stdint.h>
+
+// record states
+#define LOG_WRAP	0				// filler to the end of the region, skipped over
+#define LOG_USED	1				// handed out
+
+// every record starts with one of these, the caller gets what follows it
+typedef struct _LogRec {
+	uint16_t size;					// whole record including this, multiple of 4
+	uint8_t state;
+	uint8_t spare;
+} LogRec;
+
+typedef struct _MsgLog {
+	uint8_t *base;					// start of the region, word aligned
+	uint32_t size;					// region length, multiple of 4
+	uint32_t head;					// offset of the oldest record
+	uint32_t tail;					// offset the next record goes at
+	uint32_t used;					// bytes between head and tail, fillers included
+} MsgLog;
+
+void MsgLog_init(MsgLog *log, void *base, uint32_t size);
+uint8_t MsgLog_fits(MsgLog *log, uint32_t size);
+void *MsgLog_alloc(MsgLog *log, uint32_t size);
+void MsgLog_drop(MsgLog *log);
+void MsgLog_dropTo(MsgLog *log, void *obj);
+void MsgLog_resume(MsgLog *log, void *first, void *last);
+
+#define MsgLog_free(A) ((A)->size - (A)->used)
+
+#endif /* __MSGLOG_H */
@@ -0,0 +1,130 @@
+/*------------------------------------------------------------------------------
+ *   
+ *------------------------------------------------------------------------------
+ *      Name:    PosIndex.c
+ *      Purpose: Order statistics over a fixed array of slots
+ *      Note(s): A bitmap says which slots are in use.  A Fenwick tree keeps
+ *               how many are in use per POS_CHUNK slots, so both directions
+ *               (slot -> position, position -> slot) are a tree walk plus a
+ *               popcount of at most one chunk, however full it gets.
+ *               Not locked, the caller holds whatever protects the slots.
+ *------------------------------------------------------------------------------
+ *      
+ *----------------------------------------------------------------------------*/
+
+#include <stm32f2xx.h>
+#include "PosIndex.h"
+
+#define CHUNK_WORDS (POS_CHUNK / 32)
+
+static uint32_t popcount(uint32_t v){
+	v = v - ((v >> 1) & 0x55555555);
+	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+	return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+// add delta to chunk c's count
+static void treeAdd(PosIndex *idx, uint32_t c, int32_t delta){
+	for (c++; c <= idx->chunks; c += c & (0 - c)){
+		idx->tree[c] += delta;
+	}
+}
+
+// slots in use in chunks below c
+static uint32_t treeSum(PosIndex *idx, uint32_t c){
+	uint32_t sum = 0;
+	for (; c > 0; c -= c & (0 - c)){
+		sum += idx->tree[c];
+	}
+	return sum;
+}
+
+void PosIndex_init(PosIndex *idx, uint32_t *bits, uint32_t *tree, uint32_t size){
+	uint32_t i;
+	idx->bits = bits;
+	idx->tree = tree;
+	idx->size = size;
+	idx->chunks = POS_CHUNKS(size);
+	idx->total = 0;
+	for (i = 0; i < POS_WORDS(size); i++){
+		bits[i] = 0;
+	}
+	for (i = 0; i <= idx->chunks; i++){
+		tree[i] = 0;
+	}
+}
+
+void PosIndex_set(PosIndex *idx, uint32_t slot){
+	uint32_t mask = 1UL << (slot % 32);
+	if (!(idx->bits[slot / 32] & mask)){
+		idx->bits[slot / 32] |= mask;
+		treeAdd(idx, slot / POS_CHUNK, 1);
+		idx->total++;
+	}
+}
+
+void PosIndex_clear(PosIndex *idx, uint32_t slot){
+	uint32_t mask = 1UL << (slot % 32);
+	if (idx->bits[slot / 32] & mask){
+		idx->bits[slot / 32] &= ~mask;
+		treeAdd(idx, slot / POS_CHUNK, -1);
+		idx->total--;
+	}
+}
+
+// clear slots from up to (not including) to, a word and a tree update per
+// chunk at a time rather than slot by slot
+void PosIndex_clearRange(PosIndex *idx, uint32_t from, uint32_t to){
+	uint32_t w, mask, n, gone = 0;
+	while (from < to){
+		w = from / 32;
+		mask = 0xFFFFFFFFUL << (from % 32);
+		if (to < (w + 1) * 32){
+			mask &= (1UL << (to % 32)) - 1;
+		}
+		n = popcount(idx->bits[w] & mask);
+		idx->bits[w] &= ~mask;
+		gone += n;
+		from = (w + 1) * 32;
+		if (from % POS_CHUNK == 0 || from >= to){	// end of a chunk, or of the range
+			treeAdd(idx, w / CHUNK_WORDS, -(int32_t)gone);
+			idx->total -= gone;
+			gone = 0;
+		}
+	}
+}
+
+// how many slots below this one are in use
+uint32_t PosIndex_rank(PosIndex *idx, uint32_t slot){
+	uint32_t w, rank = treeSum(idx, slot / POS_CHUNK);
+	for (w = slot / POS_CHUNK * CHUNK_WORDS; w < slot / 32; w++){
+		rank += popcount(idx->bits[w]);
+	}
+	return rank + popcount(idx->bits[slot / 32] & ((1UL << (slot % 32)) - 1));
+}
+
+// which slot is the k-th in use, counting from 0.  size if there aren't that many.
+uint32_t PosIndex_select(PosIndex *idx, uint32_t k){
+	uint32_t c = 0, step, w, n, bits;
+	if (k >= idx->total){
+		return idx->size;
+	}
+	for (step = 1; step * 2 <= idx->chunks; step *= 2);
+	for (; step > 0; step /= 2){	// find the chunk, standard Fenwick descent
+		if (c + step <= idx->chunks && idx->tree[c + step] <= k){
+			c += step;
+			k -= idx->tree[c];
+		}
+	}
+	for (w = c * CHUNK_WORDS; ; w++){	// then the word in it
+		n = popcount(idx->bits[w]);
+		if (k < n){
+			break;
+		}
+		k -= n;
+	}
+	for (bits = idx->bits[w]; k > 0; k--){	// then the bit, dropping the lower ones
+		bits &= bits - 1;
+	}
+	return w * 32 + popcount((bits & (0 - bits)) - 1);
+}
@@ -0,0 +1,38 @@
+/*-----------------------------------------------------------------------------
+ * Name:    PosIndex.h
+ * Purpose: Order statistics over a fixed array of slots: which slots are in
+ *          use, how many in-use slots come before a given one, and which
+ *          slot is the k-th in use, all in O(log n)
+ *-----------------------------------------------------------------------------
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __POSINDEX_H
+#define __POSINDEX_H
+
+#include <stdint.h>
+
+// slots are counted in chunks of this many, a Fenwick tree over the chunk
+// counts finds the chunk and a popcount over its bitmap words the slot
+#define POS_CHUNK 256
+
+// storage the caller provides for size slots
+#define POS_WORDS(size) (((size) + 31) / 32)
+#define POS_CHUNKS(size) (((size) + POS_CHUNK - 1) / POS_CHUNK)
+
+typedef struct _PosIndex {
+	uint32_t *bits;					// one bit per slot, POS_WORDS(size) long
+	uint32_t *tree;					// Fenwick tree of per chunk counts, POS_CHUNKS(size) + 1 long
+	uint32_t size;					// slots
+	uint32_t chunks;
+	uint32_t total;					// slots in use
+} PosIndex;
+
+void PosIndex_init(PosIndex *idx, uint32_t *bits, uint32_t *tree, uint32_t size);
+void PosIndex_set(PosIndex *idx, uint32_t slot);
+void PosIndex_clear(PosIndex *idx, uint32_t slot);
+void PosIndex_clearRange(PosIndex *idx, uint32_t from, uint32_t to);
+uint32_t PosIndex_rank(PosIndex *idx, uint32_t slot);
+uint32_t PosIndex_select(PosIndex *idx, uint32_t k);
+
+#endif /* __POSINDEX_H */
@@ -0,0 +1,64 @@
+/*------------------------------------------------------------------------------
+ *   
+ *------------------------------------------------------------------------------
+ *      Name:    RingBuffer.c
+ *      Purpose: Lock-free single-producer/single-consumer byte ring
+ *      Note(s): One side may be an ISR.  Each index has exactly one writer,
+ *               and the data store is ordered before the index store, so
+ *               neither side ever needs a mutex or to mask interrupts.
+ *------------------------------------------------------------------------------
+ *      
+ *----------------------------------------------------------------------------*/
+
+#include <stm32f2xx.h>
+#include "RingBuffer.h"
+
+// size must be a power of two
+void Ring_init(RingBuffer *ring, uint8_t *buf, uint32_t size){
+	ring->head = 0;
+	ring->tail = 0;
+	ring->overflows = 0;
+	ring->mask = size - 1;
+	ring->buf = buf;
+}
+
+// put one byte, returns FALSE (and counts it) if the ring was full
+uint8_t Ring_put(RingBuffer *ring, uint8_t data){
+	uint32_t head = ring->head;
+	if (head - ring->tail > ring->mask){	// full, the consumer hasn't caught up
+		ring->overflows++;
+		return 0;
+	}
+	ring->buf[head & ring->mask] = data;
+	__DMB();								// byte has to land before the consumer can see it
+	ring->head = head + 1;
+	return 1;
+}
+
+// take one byte, returns FALSE if the ring was empty
+uint8_t Ring_get(RingBuffer *ring, uint8_t *data){
+	uint32_t tail = ring->tail;
+	if (tail == ring->head){
+		return 0;
+	}
+	*data = ring->buf[tail & ring->mask];
+	__DMB();								// read the byte before handing the slot back
+	ring->tail = tail + 1;
+	return 1;
+}
+
+// look at the oldest byte without taking it, returns FALSE if the ring was empty
+uint8_t Ring_peek(RingBuffer *ring, uint8_t *data){
+	uint32_t tail = ring->tail;
+	if (tail == ring->head){
+		return 0;
+	}
+	*data = ring->buf[tail & ring->mask];
+	return 1;
+}
+
+// hand back the byte Ring_peek() looked at
+void Ring_skip(RingBuffer *ring){
+	__DMB();
+	ring->tail++;
+}
@@ -0,0 +1,37 @@
+/*-----------------------------------------------------------------------------
+ * Name:    RingBuffer.h
+ * Purpose: Single-producer/single-consumer byte ring, safe between one ISR
+ *          and one task without locking
+ *-----------------------------------------------------------------------------
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __RINGBUF_H
+#define __RINGBUF_H
+
+#include <stdint.h>
+
+// head and tail run freely and are masked on access, so the size has to be
+// a power of two.  Only the producer writes head, only the consumer writes tail.
+typedef struct _RingBuffer {
+	volatile uint32_t head;				// total bytes ever put
+	volatile uint32_t tail;				// total bytes ever taken
+	volatile uint32_t overflows;	// bytes dropped because the ring was full
+	uint32_t mask;								// size - 1
+	uint8_t *buf;									// storage, size bytes long
+} RingBuffer;
+
+void Ring_init(RingBuffer *ring, uint8_t *buf, uint32_t size);
+
+// producer side
+uint8_t Ring_put(RingBuffer *ring, uint8_t data);
+
+// consumer side
+uint8_t Ring_get(RingBuffer *ring, uint8_t *data);
+uint8_t Ring_peek(RingBuffer *ring, uint8_t *data);
+void Ring_skip(RingBuffer *ring);
+
+#define Ring_used(A) ((A)->head - (A)->tail)
+#define Ring_free(A) ((A)->mask + 1 - Ring_used(A))
+
+#endif /* __RINGBUF_H */
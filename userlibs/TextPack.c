@@ -0,0 +1,114 @@
+/*------------------------------------------------------------------------------
+ *   
+ *------------------------------------------------------------------------------
+ *      Name:    TextPack.c
+ *      Purpose: 6-bit packing for printable ASCII message text
+ *      Note(s): Anything outside 0x20-0x7E is stored as '?'.  Escaped
+ *               characters mean a character's position isn't a fixed bit
+ *               offset, so reading from the middle skips codes first; that's
+ *               a shift and a compare per character, no table lookups.
+ *------------------------------------------------------------------------------
+ *      
+ *----------------------------------------------------------------------------*/
+
+#include <stm32f2xx.h>
+#include "TextPack.h"
+
+// code -> character for the one-code characters, TEXT_ESC has none
+static const uint8_t plain[64] =
+	" abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+// second code -> character after a TEXT_ESC
+static const uint8_t punct[32] = "!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+
+// character -> code, 0x40 and up means TEXT_ESC then (code - 0x40)
+static uint8_t code(uint8_t c){
+	if (c == ' '){
+		return 0;
+	} else if (c >= 'a' && c <= 'z'){
+		return c - 'a' + 1;
+	} else if (c >= 'A' && c <= 'Z'){
+		return c - 'A' + 27;
+	} else if (c >= '0' && c <= '9'){
+		return c - '0' + 53;
+	} else if (c >= '!' && c <= '/'){
+		return 0x40 + c - '!';					// punct[0..14]
+	} else if (c >= ':' && c <= '@'){
+		return 0x40 + 15 + c - ':';			// punct[15..21]
+	} else if (c >= '[' && c <= '`'){
+		return 0x40 + 22 + c - '[';			// punct[22..27]
+	} else if (c >= '{' && c <= '~'){
+		return 0x40 + 28 + c - '{';			// punct[28..31]
+	}
+	return 0x40 + 20;									// '?'
+}
+
+// bytes the packed text takes
+uint8_t Text_packedSize(const uint8_t *text, uint8_t cnt){
+	uint16_t codes = cnt;
+	uint8_t i;
+	for (i = 0; i < cnt; i++){
+		if (code(text[i]) >= 0x40){
+			codes++;
+		}
+	}
+	return (codes * 6 + 7) / 8;
+}
+
+void Text_pack(uint8_t *dst, const uint8_t *text, uint8_t cnt){
+	uint32_t bits = 0;
+	uint8_t have = 0, i, c;
+	for (i = 0; i < cnt; i++){
+		c = code(text[i]);
+		if (c >= 0x40){
+			bits |= (uint32_t)TEXT_ESC << have;
+			have += 6;
+			c -= 0x40;
+		}
+		bits |= (uint32_t)c << have;
+		have += 6;
+		while (have >= 8){
+			*dst++ = bits;
+			bits >>= 8;
+			have -= 8;
+		}
+	}
+	if (have != 0){
+		*dst = bits;
+	}
+}
+
+// next code, loading a byte when it runs short
+static uint8_t next(TextCursor *cur){
+	uint8_t c;
+	if (cur->have < 6){
+		cur->bits |= (uint32_t)*cur->src++ << cur->have;
+		cur->have += 8;
+	}
+	c = cur->bits & 0x3F;
+	cur->bits >>= 6;
+	cur->have -= 6;
+	return c;
+}
+
+// start reading at character from
+void Text_seek(TextCursor *cur, const uint8_t *src, uint8_t from){
+	cur->src = src;
+	cur->bits = 0;
+	cur->have = 0;
+	while (from > 0){
+		if (next(cur) == TEXT_ESC){
+			next(cur);
+		}
+		from--;
+	}
+}
+
+// the next n characters, the caller knows there are that many
+void Text_read(TextCursor *cur, uint8_t *dst, uint8_t n){
+	uint8_t c;
+	while (n > 0){
+		c = next(cur);
+		*dst++ = c == TEXT_ESC ? punct[next(cur)] : plain[c];
+		n--;
+	}
+}
@@ -0,0 +1,30 @@
+/*-----------------------------------------------------------------------------
+ * Name:    TextPack.h
+ * Purpose: 6-bit packing for printable ASCII message text
+ *-----------------------------------------------------------------------------
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __TEXTPACK_H
+#define __TEXTPACK_H
+
+#include <stdint.h>
+
+// Space, letters and digits are one 6-bit code each, the 32 punctuation
+// characters are TEXT_ESC followed by a second code.  Codes are packed LSB
+// first, so 4 plain characters take 3 bytes.
+#define TEXT_ESC 63
+
+// where a read has got to in some packed text
+typedef struct _TextCursor {
+	const uint8_t *src;			// next byte to load
+	uint32_t bits;					// loaded, not yet used, LSB first
+	uint8_t have;						// how many of them
+} TextCursor;
+
+uint8_t Text_packedSize(const uint8_t *text, uint8_t cnt);
+void Text_pack(uint8_t *dst, const uint8_t *text, uint8_t cnt);
+void Text_seek(TextCursor *cur, const uint8_t *src, uint8_t from);
+void Text_read(TextCursor *cur, uint8_t *dst, uint8_t n);
+
+#endif /* __TEXTPACK_H */
@@ -0,0 +1,100 @@
+/*------------------------------------------------------------------------------
+ *   
+ *------------------------------------------------------------------------------
+ *      Name:    Trigram.c
+ *      Purpose: Inverted trigram index over chunks of a slot array
+ *      Note(s): Trigrams are case folded.  Not locked, the caller holds
+ *               whatever protects the slots.
+ *------------------------------------------------------------------------------
+ *      
+ *----------------------------------------------------------------------------*/
+
+#include <stm32f2xx.h>
+#include "Trigram.h"
+
+#define lower(c) ((c) >= 'A' && (c) <= 'Z' ? (c) | 0x20 : (c))
+
+// which bucket the trigram at text goes in
+static uint32_t bucket(const uint8_t *text){
+	uint32_t h = (lower(text[0]) << 16) | (lower(text[1]) << 8) | lower(text[2]);
+	h *= 2654435761UL;
+	return h >> (32 - TRI_BITS);	// top bits, TRI_BUCKETS of them
+}
+
+// mem is used as it is, so an index that survived a reset can carry on
+void Tri_init(TrigramIndex *idx, void *mem, uint32_t chunks){
+	idx->bits = (uint32_t *)mem;
+	idx->chunks = chunks;
+	idx->words = (chunks + 31) / 32;
+}
+
+void Tri_clear(TrigramIndex *idx){
+	uint32_t i;
+	for (i = 0; i < TRI_BUCKETS * idx->words; i++){
+		idx->bits[i] = 0;
+	}
+}
+
+// post every trigram of text under chunk
+void Tri_add(TrigramIndex *idx, uint32_t chunk, const uint8_t *text, uint8_t cnt){
+	uint32_t mask = 1UL << (chunk % 32);
+	uint32_t *word = idx->bits + chunk / 32;
+	uint8_t i;
+	for (i = 0; i + 3 <= cnt; i++){
+		word[bucket(text + i) * idx->words] |= mask;
+	}
+}
+
+// forget everything posted under chunk, once nothing in it is wanted
+void Tri_clearChunk(TrigramIndex *idx, uint32_t chunk){
+	uint32_t mask = ~(1UL << (chunk % 32));
+	uint32_t *word = idx->bits + chunk / 32;
+	uint32_t b;
+	for (b = 0; b < TRI_BUCKETS; b++){
+		word[b * idx->words] &= mask;
+	}
+}
+
+// drops chunks from up to (not including) to, a word at a time rather
+// than a chunk at a time
+void Tri_clearRange(TrigramIndex *idx, uint32_t from, uint32_t to){
+	uint32_t first = from / 32, last = (to - 1) / 32;
+	uint32_t lo = 0xFFFFFFFFUL << (from % 32);				// from and up in the first word
+	uint32_t hi = 0xFFFFFFFFUL >> (31 - (to - 1) % 32);	// to - 1 and down in the last
+	uint32_t *word;
+	uint32_t b, w;
+	if (from >= to){
+		return;
+	}
+	if (first == last){
+		lo &= hi;
+	}
+	for (b = 0; b < TRI_BUCKETS; b++){
+		word = idx->bits + b * idx->words;
+		word[first] &= ~lo;
+		if (first != last){
+			for (w = first + 1; w < last; w++){
+				word[w] = 0;
+			}
+			word[last] &= ~hi;
+		}
+	}
+}
+
+// chunks that could contain text, into cand (words long).  Returns FALSE
+// if text is too short to have a trigram, cand is then every chunk.
+uint8_t Tri_query(TrigramIndex *idx, const uint8_t *text, uint8_t cnt, uint32_t *cand){
+	const uint32_t *set;
+	uint32_t w;
+	uint8_t i;
+	for (w = 0; w < idx->words; w++){
+		cand[w] = 0xFFFFFFFFUL;
+	}
+	for (i = 0; i + 3 <= cnt; i++){
+		set = idx->bits + bucket(text + i) * idx->words;
+		for (w = 0; w < idx->words; w++){
+			cand[w] &= set[w];
+		}
+	}
+	return cnt >= 3;
+}
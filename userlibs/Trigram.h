@@ -0,0 +1,38 @@
+/*-----------------------------------------------------------------------------
+ * Name:    Trigram.h
+ * Purpose: Inverted trigram index over chunks of a slot array, for finding
+ *          which chunks could hold a piece of text without reading any
+ *-----------------------------------------------------------------------------
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __TRIGRAM_H
+#define __TRIGRAM_H
+
+#include <stdint.h>
+
+#define TRI_BITS 10							// trigrams hash into 2^TRI_BITS buckets
+#define TRI_BUCKETS (1UL << TRI_BITS)
+#define TRI_CHUNK 8							// slots per chunk, a posting is one bit per chunk; divides 32
+
+// bytes of index for this many chunks
+#define Tri_size(chunks) (TRI_BUCKETS * (((chunks) + 31) / 32) * 4UL)
+
+// Each bucket is a bitset with a bit per chunk, set if some text in the
+// chunk had a trigram that hashes there.  Bits are never cleared one text
+// at a time, only a whole chunk at once, so a chunk can show up that no
+// longer has a match; callers check the text.
+typedef struct _TrigramIndex {
+	uint32_t *bits;					// TRI_BUCKETS bitsets, words long each
+	uint32_t chunks;
+	uint32_t words;					// per bucket
+} TrigramIndex;
+
+void Tri_init(TrigramIndex *idx, void *mem, uint32_t chunks);
+void Tri_clear(TrigramIndex *idx);
+void Tri_add(TrigramIndex *idx, uint32_t chunk, const uint8_t *text, uint8_t cnt);
+void Tri_clearChunk(TrigramIndex *idx, uint32_t chunk);
+void Tri_clearRange(TrigramIndex *idx, uint32_t from, uint32_t to);
+uint8_t Tri_query(TrigramIndex *idx, const uint8_t *text, uint8_t cnt, uint32_t *cand);
+
+#endif /* __TRIGRAM_H */